@@ -0,0 +1,715 @@
+#include "bench.h"
+#include "gtfs.h"
+#include "timetable.h"
+#include "raptor.h"
+#include "raptor_range.h"
+#include "mc_raptor.h"
+#include "trip_search.h"
+#include "footpath_relax.h"
+#include "gtfs_csv.h"
+#include "time_parse.h"
+#include "footpaths.h"
+#include "csv.hpp"
+
+#include <array>
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <omp.h>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Hardware cache-miss counter for the calling thread; reads -1 where perf events are unavailable.
+class CacheMissCounter {
+public:
+    CacheMissCounter() {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~CacheMissCounter() {
+        if (fd >= 0) close(fd);
+    }
+
+    void start() {
+        if (fd < 0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    long long stop() {
+        if (fd < 0) return -1;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        long long count = 0;
+        if (read(fd, &count, sizeof(count)) != sizeof(count)) return -1;
+        return count;
+    }
+
+private:
+    int fd;
+};
+
+// keeps benchmarked loops from being optimised away
+static volatile long long sink;
+
+struct BenchResult {
+    double seconds;
+    long long cache_misses;
+};
+
+template <typename F>
+static BenchResult measure(F &&f) {
+    CacheMissCounter counter;
+    auto start = chrono::high_resolution_clock::now();
+    counter.start();
+    f();
+    long long misses = counter.stop();
+    auto end = chrono::high_resolution_clock::now();
+    return { chrono::duration<double>(end - start).count(), misses };
+}
+
+static void report(const string &label, const BenchResult &r, size_t ops, const string &op = "scan") {
+    cout << "  " << label << ": " << r.seconds * 1e9 / ops << " ns/" << op;
+    if (r.cache_misses >= 0)
+        cout << ", " << double(r.cache_misses) / ops << " cache misses/scan";
+    else
+        cout << ", cache misses n/a";
+    cout << '\n';
+}
+
+// A route scan as raptor() performs it: find the earliest trip departing a stop
+// position, then read that trip's arrivals along the rest of the pattern. The
+// legacy variant walks the GTFS-keyed TripInfo maps the same way.
+static void bench_layout() {
+    struct Scan { uint32_t pattern; uint32_t pos; int board_time; };
+
+    const size_t num_scans = 200000;
+    mt19937 gen(1);
+    uniform_int_distribution<uint32_t> pattern_dist(0, TT.num_patterns() - 1);
+    uniform_int_distribution<int> time_dist(36000, 64800);
+
+    vector<Scan> scans(num_scans);
+    for (auto &scan : scans) {
+        scan.pattern = pattern_dist(gen);
+        scan.pos = uniform_int_distribution<uint32_t>(0, TT.pattern_size(scan.pattern) - 1)(gen);
+        scan.board_time = time_dist(gen);
+    }
+
+    // what the legacy scan has to hand: GTFS trip ids and GTFS stop ids per pattern
+    vector<vector<const TripInfo*>> legacy_trips(TT.num_patterns());
+    vector<vector<int>> legacy_stops(TT.num_patterns());
+    for (uint32_t p = 0; p < TT.num_patterns(); ++p) {
+        for (uint32_t t = TT.pattern_trip_offsets[p]; t < TT.pattern_trip_offsets[p + 1]; ++t)
+            legacy_trips[p].push_back(&Trips.at(string(TT.trip_ids[t])));
+        for (uint32_t i = 0; i < TT.pattern_size(p); ++i)
+            legacy_stops[p].push_back(TT.stop_ids[TT.stops_of(p)[i]]);
+    }
+
+    long long legacy_sum = 0, compiled_sum = 0;
+
+    BenchResult legacy = measure([&] {
+        for (const Scan &scan : scans) {
+            const auto &stops = legacy_stops[scan.pattern];
+            const TripInfo *best = nullptr;
+            int best_dep = NO_TIME;
+            for (const TripInfo *trip : legacy_trips[scan.pattern]) {
+                int dep = trip->stops.at(stops[scan.pos]).second;
+                if (dep >= scan.board_time && dep < best_dep) {
+                    best_dep = dep;
+                    best = trip;
+                }
+            }
+            if (!best) continue;
+            for (size_t i = scan.pos; i < stops.size(); ++i)
+                legacy_sum += best->stops.at(stops[i]).first;
+        }
+    });
+
+    BenchResult compiled = measure([&] {
+        for (const Scan &scan : scans) {
+            const int32_t *departures = TT.stop_departures(scan.pattern, scan.pos);
+            uint32_t best = NO_INDEX;
+            int best_dep = NO_TIME;
+            for (uint32_t t = 0; t < TT.pattern_trip_count(scan.pattern); ++t) {
+                if (departures[t] >= scan.board_time && departures[t] < best_dep) {
+                    best_dep = departures[t];
+                    best = TT.pattern_trip_offsets[scan.pattern] + t;
+                }
+            }
+            if (best == NO_INDEX) continue;
+            const int32_t *arrivals = TT.trip_arrivals(best);
+            for (uint32_t i = scan.pos; i < TT.pattern_size(scan.pattern); ++i)
+                compiled_sum += arrivals[i];
+        }
+    });
+
+    sink = legacy_sum + compiled_sum;
+
+    cout << "layout: " << num_scans << " route scans over " << TT.num_patterns() << " patterns\n";
+    report("TripInfo maps", legacy, num_scans);
+    report("pattern matrices", compiled, num_scans);
+}
+
+// Earliest-departure searches on the departure columns of real patterns, once
+// per supported kernel, over all patterns and over the long ones only.
+static void bench_departure_search() {
+    struct Search { const int32_t *departures; uint32_t num_trips; int board_time; };
+
+    const size_t num_searches = 1000000;
+    const uint32_t long_pattern = 64;
+    mt19937 gen(1);
+    uniform_int_distribution<int> time_dist(18000, 86400);
+
+    vector<uint32_t> all_patterns, long_patterns;
+    for (uint32_t p = 0; p < TT.num_patterns(); ++p) {
+        all_patterns.push_back(p);
+        if (TT.pattern_trip_count(p) >= long_pattern)
+            long_patterns.push_back(p);
+    }
+
+    auto make_searches = [&](const vector<uint32_t> &patterns) {
+        vector<Search> searches(patterns.empty() ? 0 : num_searches);
+        for (auto &search : searches) {
+            uint32_t p = patterns[gen() % patterns.size()];
+            search = { TT.stop_departures(p, gen() % TT.pattern_size(p)), TT.pattern_trip_count(p), time_dist(gen) };
+        }
+        return searches;
+    };
+
+    auto run = [&](const string &label, const vector<Search> &searches) {
+        if (searches.empty()) {
+            cout << label << ": no patterns\n";
+            return;
+        }
+        double trips = 0;
+        for (const Search &search : searches) trips += search.num_trips;
+        cout << label << ": " << searches.size() << " searches, " << trips / searches.size() << " trips on average\n";
+
+        for (const auto &kernel : search_kernels()) {
+            if (!kernel.supported) continue;
+            uint64_t sum = 0;
+            BenchResult r = measure([&] {
+                for (const Search &search : searches)
+                    sum += kernel.fn(search.departures, search.num_trips, search.board_time);
+            });
+            sink = sum;
+            report(kernel.name, r, searches.size(), "search");
+        }
+    };
+
+    cout << "departure-search: selected kernel " << first_at_least_name << '\n';
+    run("all patterns", make_searches(all_patterns));
+    run("patterns with >= " + to_string(long_pattern) + " trips", make_searches(long_patterns));
+}
+
+// Footpath relaxations from random stops against labels laid out as raptor()
+// keeps them (K = 5), with every relaxation kernel. The second run cuts each
+// stop's footpaths, ordered by walk time, at a bound 10 minutes after the
+// walk starts, as the bound at the destination does in raptor().
+static void bench_footpath_relax() {
+    struct Relaxation { uint32_t stop; int32_t base; };
+
+    const size_t num_relaxations = 1000000;
+    const uint32_t stride = 6;
+    const int32_t cutoff = 600;
+    mt19937 gen(1);
+    uniform_int_distribution<int> time_dist(18000, 86400);
+
+    vector<int32_t> labels(size_t(TT.num_stops()) * stride);
+    for (int32_t &label : labels) label = gen() % 4 == 0 ? NO_TIME : time_dist(gen);
+
+    vector<uint32_t> walking_stops;
+    uint32_t max_footpaths = 0;
+    for (uint32_t s = 0; s < TT.num_stops(); ++s) {
+        uint32_t n = TT.transfer_offsets[s + 1] - TT.transfer_offsets[s];
+        if (n > 0) walking_stops.push_back(s);
+        max_footpaths = max(max_footpaths, n);
+    }
+    if (walking_stops.empty()) {
+        cout << "footpath-relax: no footpaths\n";
+        return;
+    }
+    vector<Relaxation> relaxations(num_relaxations);
+    for (auto &r : relaxations) r = { walking_stops[gen() % walking_stops.size()], time_dist(gen) };
+    vector<uint32_t> improved(max_footpaths);
+
+    auto run = [&](const string &label, bool cut) {
+        double footpaths = 0;
+        for (const Relaxation &r : relaxations) {
+            uint32_t first = TT.transfer_offsets[r.stop], n = TT.transfer_offsets[r.stop + 1] - first;
+            footpaths += cut ? first_at_least(TT.transfer_walk_times.data() + first, n, cutoff) : n;
+        }
+        cout << label << ": " << relaxations.size() << " relaxations, " << footpaths / relaxations.size()
+             << " footpaths on average\n";
+
+        for (const auto &kernel : relax_kernels()) {
+            if (!kernel.supported) continue;
+            uint64_t sum = 0;
+            BenchResult result = measure([&] {
+                for (const Relaxation &r : relaxations) {
+                    uint32_t first = TT.transfer_offsets[r.stop], n = TT.transfer_offsets[r.stop + 1] - first;
+                    const int32_t *walks = TT.transfer_walk_times.data() + first;
+                    if (cut) n = first_at_least(walks, n, cutoff);
+                    sum += kernel.fn(TT.transfer_targets.data() + first, walks, n, r.base, labels.data() + 1, stride,
+                                     improved.data());
+                }
+            });
+            sink = sum;
+            report(kernel.name, result, relaxations.size(), "relaxation");
+        }
+    };
+
+    cout << "footpath-relax: selected kernel " << relax_footpaths_name << '\n';
+    run("every footpath", false);
+    run("footpaths up to " + to_string(cutoff) + " s", true);
+}
+
+struct LoadResult {
+    double seconds;
+    long peak_rss_kb;
+    size_t rows;
+};
+
+// Runs `load` in a forked child, so that each loader starts from the same
+// memory state and its peak RSS (ru_maxrss from wait4) is its own.
+template <typename F>
+static LoadResult measure_load(F &&load) {
+    int fds[2];
+    if (pipe(fds) != 0) return { -1, -1, 0 };
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        auto start = chrono::high_resolution_clock::now();
+        size_t rows = load();
+        auto end = chrono::high_resolution_clock::now();
+        LoadResult result = { chrono::duration<double>(end - start).count(), 0, rows };
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(written == sizeof(result) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    LoadResult result = { -1, -1, 0 };
+    if (pid < 0 || read(fds[0], &result, sizeof(result)) != sizeof(result)) result.seconds = -1;
+    close(fds[0]);
+
+    int status;
+    struct rusage usage;
+    if (pid > 0 && wait4(pid, &status, 0, &usage) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        result.peak_rss_kb = usage.ru_maxrss;
+    else
+        result.seconds = -1;
+    return result;
+}
+
+// stop_times.txt as load_stop_times() read it before gtfs_csv.h: every csv.hpp
+// row is kept, then its fields are copied into strings.
+static size_t load_stop_times_csv(const string &path) {
+    struct StringStopTime {
+        string trip_id;
+        string arrival_time;
+        string departure_time;
+        int stop_id;
+    };
+
+    csv::CSVReader reader(path);
+    vector<csv::CSVRow> rows;
+    for (auto& row : reader) {
+        rows.push_back(row);
+    }
+    vector<StringStopTime> stop_times(rows.size());
+
+    #pragma omp parallel for num_threads(4)
+    for (size_t i = 0; i < rows.size(); ++i) {
+        StringStopTime entry;
+        entry.trip_id = rows[i]["trip_id"].get<>();
+        entry.arrival_time = rows[i]["arrival_time"].get<>();
+        entry.departure_time = rows[i]["departure_time"].get<>();
+        entry.stop_id = rows[i]["stop_id"].get<int>();
+        stop_times[i] = move(entry);
+    }
+    return stop_times.size();
+}
+
+// Load time and peak RSS of reading stop_times.txt with csv.hpp and with the
+// mapped parser at 1, 2, 4, ... threads up to OMP_NUM_THREADS or the core count.
+// Each loader runs `repetitions` times; the fastest run is shown. The file is
+// in the page cache after the first run, so this measures parsing, not disk.
+static void bench_stop_times(const string &dataset) {
+    const string path = dataset + "/stop_times.txt";
+    const int repetitions = 3;
+
+    struct rusage self;
+    getrusage(RUSAGE_SELF, &self);
+    cout << "stop-times: " << path << ", peak RSS before loading " << self.ru_maxrss / 1024.0 << " MB\n";
+
+    auto run = [&](const string &label, auto load) {
+        LoadResult best = { -1, -1, 0 };
+        for (int i = 0; i < repetitions; ++i) {
+            LoadResult r = measure_load(load);
+            if (r.seconds < 0) {
+                cout << "  " << label << ": failed\n";
+                return;
+            }
+            if (best.seconds < 0 || r.seconds < best.seconds) best = r;
+        }
+        cout << "  " << label << ": " << best.rows << " rows, " << best.seconds << " s, peak RSS "
+             << best.peak_rss_kb / 1024.0 << " MB\n";
+    };
+
+    run("csv.hpp rows", [&] { return load_stop_times_csv(path); });
+    // the mapped parser splits the file by byte ranges, one per thread
+    const int max_threads = omp_get_max_threads();
+    for (int threads = 1;; threads = min(threads * 2, max_threads)) {
+        run("mapped parser, " + to_string(threads) + " threads", [&] {
+            omp_set_num_threads(threads);
+            vector<StopTimeHeaders> rows;
+            vector<string> trip_ids;
+            parse_stop_times(path, rows, trip_ids);
+            return rows.size();
+        });
+        if (threads == max_threads) break;
+    }
+}
+
+// Time and peak RSS of building TT with the streaming build_all() and of
+// building the df_* tables and legacy maps, next to the size of TT itself.
+static void bench_build(const string &dataset) {
+    auto run = [&](const string &label, auto build) {
+        LoadResult r = measure_load(build);
+        if (r.seconds < 0) {
+            cout << "  " << label << ": failed\n";
+            return;
+        }
+        cout << "  " << label << ": " << r.seconds << " s, peak RSS " << r.peak_rss_kb / 1024.0 << " MB";
+        if (r.rows > 0) cout << ", timetable " << r.rows / (1024.0 * 1024.0) << " MB";
+        cout << '\n';
+    };
+
+    cout << "build: " << dataset << '\n';
+    // the "rows" of the streaming build are the bytes of the compiled timetable
+    run("streaming build_all", [&] {
+        build_all(dataset);
+        size_t bytes = 0;
+        TT.for_each_array([&](auto &array) { bytes += array.size() * sizeof(array[0]); });
+        return bytes;
+    });
+    run("df_* tables and legacy maps", [&] {
+        build_legacy_maps(dataset);
+        return size_t(0);
+    });
+}
+
+// Filter that keeps every candidate, so that each one is measured with haversine.
+static uint32_t keep_all(const double *, const double *, const double *, uint32_t n, double, double, double, double,
+                         uint32_t *out) {
+    for (uint32_t k = 0; k < n; ++k) out[k] = k;
+    return n;
+}
+
+// Footpath search over stops.txt tiled side by side 1, 10 and 100 times, as a
+// synthetic feed with that many times the stops at the same density. The grid
+// is timed at every size without a distance filter and with every filter
+// kernel; measuring all pairs is quadratic, so it is only timed up to 10 tiles.
+static void bench_footpaths(const string &dataset) {
+    vector<StopHeaders> stops;
+    parse_stops(dataset + "/stops.txt", stops);
+    if (stops.empty()) return;
+    double min_lon = stops[0].stop_lon, max_lon = stops[0].stop_lon;
+    for (auto &s : stops) {
+        min_lon = min(min_lon, s.stop_lon);
+        max_lon = max(max_lon, s.stop_lon);
+    }
+    // tiles are far enough apart not to share footpaths
+    const double tile_width = max_lon - min_lon + 0.1;
+
+    cout << "footpaths: " << dataset << ", " << stops.size() << " stops per tile\n";
+    for (int tiles : { 1, 10, 100 }) {
+        StopPoints points;
+        for (int t = 0; t < tiles; ++t) {
+            for (auto &s : stops)
+                points.add(points.size(), s.stop_lat, s.stop_lon + t * tile_width);
+        }
+        cout << "  " << tiles << " tiles, " << points.size() << " stops:\n";
+
+        auto run = [&](const string &label, auto find) {
+            vector<Footpath> footpaths;
+            BenchResult r = measure([&] { footpaths = find(); });
+            cout << "    " << label << ": " << r.seconds << " s, " << footpaths.size() << " footpaths\n";
+        };
+        if (tiles <= 10) run("all pairs", [&] { return find_footpaths_all_pairs(points, MAX_WALK_DISTANCE); });
+        run("grid, no filter", [&] { return find_footpaths(points, MAX_WALK_DISTANCE, keep_all); });
+        for (const auto &kernel : near_filter_kernels()) {
+            if (!kernel.supported) continue;
+            run(string("grid, ") + kernel.name + " filter", [&] { return find_footpaths(points, MAX_WALK_DISTANCE, kernel.fn); });
+        }
+    }
+}
+
+// Footpath graphs closed within 0 (not closed), 10, 15, 20 and 30 minutes of
+// walking: the time close_footpaths() takes over the footpaths of stops.txt,
+// the edges it leaves, and the time and results of random queries on a
+// timetable built with each graph.
+static void bench_footpath_closure(const string &dataset) {
+    const int num_queries = 200;
+    vector<StopHeaders> stops;
+    parse_stops(dataset + "/stops.txt", stops);
+    StopPoints points;
+    for (uint32_t i = 0; i < stops.size(); ++i)
+        points.add(i, stops[i].stop_lat, stops[i].stop_lon);
+    const vector<Footpath> footpaths = find_footpaths(points, MAX_WALK_DISTANCE);
+
+    cout << "footpath-closure: " << dataset << ", " << footpaths.size() << " footpaths within "
+         << MAX_WALK_DISTANCE << " m, " << num_queries << " random queries\n";
+    for (int32_t budget : { 0, 600, 900, 1200, 1800 }) {
+        vector<Footpath> closed = footpaths;
+        BenchResult closure = { 0, -1 };
+        if (budget) closure = measure([&] { closed = close_footpaths(footpaths, points.size(), budget); });
+
+        build_all(dataset, budget);
+        mt19937 gen(1);
+        uniform_int_distribution<uint32_t> stop_dist(0, TT.num_stops() - 1);
+        uniform_int_distribution<int> time_dist(36000, 64800);
+        int reached = 0;
+        long long travel_sum = 0;
+        BenchResult queries = measure([&] {
+            for (int i = 0; i < num_queries; ++i) {
+                int source = TT.stop_ids[stop_dist(gen)], dest = TT.stop_ids[stop_dist(gen)];
+                int departure = time_dist(gen);
+                int arrival = raptor_journey(source, dest, departure, 5).arrival();
+                if (arrival >= 0) {
+                    ++reached;
+                    travel_sum += arrival - departure;
+                }
+            }
+        });
+
+        cout << "  " << (budget ? "closed within " + to_string(budget) + " s" : string("not closed")) << ": "
+             << closed.size() << " footpaths (" << 2.0 * closed.size() / points.size() << " per stop), closure "
+             << closure.seconds * 1e3 << " ms, queries " << queries.seconds * 1e3 / num_queries << " ms each, "
+             << reached << " reached";
+        if (reached) cout << " in " << travel_sum / reached << " s on average";
+        cout << '\n';
+    }
+}
+
+// Random queries through the generic search engine and through the one compiled
+// for their round limit, unpruned and pruned, at K = 2, 5 and 8.
+static void bench_raptor_engines() {
+    const int num_queries = 500;
+    mt19937 gen(1);
+    uniform_int_distribution<uint32_t> stop_dist(0, TT.num_stops() - 1);
+    uniform_int_distribution<int> time_dist(36000, 64800);
+    vector<array<uint32_t, 3>> queries(num_queries);
+    for (auto &q : queries) q = { stop_dist(gen), stop_dist(gen), uint32_t(time_dist(gen)) };
+
+    QueryWorkspace workspace;
+    cout << "raptor-engines: " << num_queries << " random queries\n";
+    for (Pruning pruning : { Pruning::none, Pruning::full }) {
+        for (int K : { 2, 5, 8 }) {
+            for (RaptorEngineFn engine : { raptor_engine(0, pruning), raptor_engine(K, pruning) }) {
+                long long arrivals = 0;
+                BenchResult r = measure([&] {
+                    arrivals = 0;
+                    for (const auto &q : queries)
+                        arrivals += engine(workspace, q[0], q[1], int(q[2]), K).arrival();
+                });
+                sink = arrivals;
+                cout << "  " << (pruning == Pruning::full ? "pruned" : "unpruned") << ", K = " << K << ", "
+                     << (engine == raptor_engine(0, pruning) ? "generic" : "specialised") << ": "
+                     << r.seconds * 1e3 / num_queries << " ms/query, arrival sum " << arrivals << '\n';
+            }
+        }
+    }
+}
+
+// Profiles of random source and destination pairs over 08:00-10:00 with K = 5:
+// a raptor_journey() per minute of the window vs. raptor_range() in 1, 2 and 4
+// windows.
+static void bench_raptor_range() {
+    const int num_pairs = 50, t_begin = 8 * 3600, t_end = 10 * 3600;
+    mt19937 gen(1);
+    uniform_int_distribution<uint32_t> stop_dist(0, TT.num_stops() - 1);
+    vector<pair<int,int>> pairs(num_pairs);
+    for (auto &p : pairs) p = { TT.stop_ids[stop_dist(gen)], TT.stop_ids[stop_dist(gen)] };
+
+    cout << "raptor-range: " << num_pairs << " random pairs, 08:00-10:00, K = 5\n";
+    long long reached = 0;
+    BenchResult r = measure([&] {
+        reached = 0;
+        for (auto [source, dest] : pairs) {
+            for (int t = t_begin; t <= t_end; t += 60)
+                reached += raptor_journey(source, dest, t, 5).found();
+        }
+    });
+    sink = reached;
+    cout << "  raptor_journey() every minute: " << r.seconds * 1e3 / num_pairs << " ms/profile, "
+         << double(reached) / num_pairs << " departures reaching the destination per profile\n";
+    for (int windows : { 1, 2, 4 }) {
+        size_t journeys = 0;
+        r = measure([&] {
+            journeys = 0;
+            for (auto [source, dest] : pairs)
+                journeys += raptor_range(source, dest, t_begin, t_end, 5, windows).size();
+        });
+        sink = journeys;
+        cout << "  raptor_range(), " << windows << (windows == 1 ? " window: " : " windows: ")
+             << r.seconds * 1e3 / num_pairs << " ms/profile, " << double(journeys) / num_pairs << " journeys per profile\n";
+    }
+}
+
+// Random queries with K = 5 through raptor_journey(), unpruned and pruned, and
+// through mc_raptor(), with the slowdown of the latter and the number of
+// Pareto optimal journeys it finds.
+static void bench_mc_raptor() {
+    const int num_queries = 300;
+    mt19937 gen(1);
+    uniform_int_distribution<uint32_t> stop_dist(0, TT.num_stops() - 1);
+    uniform_int_distribution<int> time_dist(36000, 64800);
+    vector<array<int, 3>> queries(num_queries);
+    for (auto &q : queries) q = { TT.stop_ids[stop_dist(gen)], TT.stop_ids[stop_dist(gen)], time_dist(gen) };
+
+    cout << "mc-raptor: " << num_queries << " random queries, K = 5\n";
+    QueryWorkspace workspace;
+    double raptor_ms = 0;
+    for (Pruning pruning : { Pruning::none, Pruning::full }) {
+        long long reached = 0;
+        BenchResult r = measure([&] {
+            reached = 0;
+            for (const auto &q : queries)
+                reached += raptor_journey(workspace, q[0], q[1], q[2], 5, pruning).found();
+        });
+        sink = reached;
+        raptor_ms = r.seconds * 1e3 / num_queries;
+        cout << "  raptor_journey(), " << (pruning == Pruning::full ? "pruned" : "unpruned") << ": " << raptor_ms
+             << " ms/query, " << reached << " reached\n";
+    }
+
+    McWorkspace mc_workspace;
+    size_t journeys = 0, reached = 0;
+    BenchResult r = measure([&] {
+        journeys = reached = 0;
+        for (const auto &q : queries) {
+            size_t found = mc_raptor(mc_workspace, q[0], q[1], q[2], 5).size();
+            journeys += found;
+            reached += found > 0;
+        }
+    });
+    sink = journeys;
+    double mc_ms = r.seconds * 1e3 / num_queries;
+    cout << "  mc_raptor(): " << mc_ms << " ms/query (" << mc_ms / raptor_ms << "x pruned raptor_journey()), "
+         << reached << " reached, " << double(journeys) / max<size_t>(reached, 1) << " Pareto journeys per reached query\n";
+}
+
+// Arrival and departure fields of stop_times.txt, converted with sscanf on
+// std::string as gtfs_time_to_seconds() used to, and with every time kernel.
+static void bench_time_parse(const string &dataset) {
+    struct TimeFields {
+        explicit TimeFields(size_t max_rows = 0) { fields.reserve(2 * max_rows); }
+        vector<string_view> fields;
+    };
+
+    CsvFile file(dataset + "/stop_times.txt", { "arrival_time", "departure_time" });
+    vector<TimeFields> chunks;
+    file.scan_rows(chunks, [](const string_view *fields, TimeFields &chunk) {
+        chunk.fields.push_back(fields[0]);
+        chunk.fields.push_back(fields[1]);
+        return true;
+    });
+    vector<string_view> fields;
+    for (auto &chunk : chunks)
+        fields.insert(fields.end(), chunk.fields.begin(), chunk.fields.end());
+    vector<string> strings(fields.begin(), fields.end());
+    vector<int32_t> seconds(fields.size());
+    // fault the parsed pages of the file back in, so that no kernel pays for it
+    parse_time_column(fields.data(), fields.size(), seconds.data());
+
+    cout << "time-parse: " << fields.size() << " time fields, selected kernel " << parse_time_column_name << '\n';
+
+    long long sum = 0;
+    BenchResult r = measure([&] {
+        for (const string &s : strings) {
+            int hours = 0, mins = 0, secs = 0;
+            sscanf(s.c_str(), "%d:%d:%d", &hours, &mins, &secs);
+            sum += hours * 3600 + mins * 60 + secs;
+        }
+    });
+    sink = sum;
+    report("sscanf", r, fields.size(), "time");
+
+    for (const auto &kernel : time_column_kernels()) {
+        if (!kernel.supported) continue;
+        size_t done = 0;
+        r = measure([&] { done = kernel.fn(fields.data(), fields.size(), seconds.data()); });
+        if (done < fields.size()) {
+            cout << "  " << kernel.name << ": malformed time \"" << fields[done] << "\"\n";
+            continue;
+        }
+        sink = seconds[fields.size() / 2];
+        report(kernel.name, r, fields.size(), "time");
+    }
+}
+
+bool run_load_benchmark(const string &name, const string &dataset) {
+    if (name == "time-parse") {
+        bench_time_parse(dataset);
+        return true;
+    }
+    if (name == "stop-times") {
+        bench_stop_times(dataset);
+        return true;
+    }
+    if (name == "footpaths") {
+        bench_footpaths(dataset);
+        return true;
+    }
+    if (name == "footpath-closure") {
+        bench_footpath_closure(dataset);
+        return true;
+    }
+    if (name == "build") {
+        bench_build(dataset);
+        return true;
+    }
+    return false;
+}
+
+bool run_benchmark(const string &name) {
+    if (name == "layout") {
+        bench_layout();
+        return true;
+    }
+    if (name == "departure-search") {
+        bench_departure_search();
+        return true;
+    }
+    if (name == "footpath-relax") {
+        bench_footpath_relax();
+        return true;
+    }
+    if (name == "raptor-engines") {
+        bench_raptor_engines();
+        return true;
+    }
+    if (name == "raptor-range") {
+        bench_raptor_range();
+        return true;
+    }
+    if (name == "mc-raptor") {
+        bench_mc_raptor();
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,14 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+
+// Micro-benchmarks over the loaded feed, run with `main.exe --bench <name>`.
+// Returns false if there is no benchmark called `name`.
+bool run_benchmark(const std::string &name);
+
+// Benchmarks that load feed files themselves, run with the same option before
+// the feed is built. Returns false if there is no such benchmark called `name`.
+bool run_load_benchmark(const std::string &name, const std::string &dataset);
+
+#endif
@@ -0,0 +1,79 @@
+#include "footpath_relax.h"
+
+#include <immintrin.h>
+
+using namespace std;
+
+static inline uint32_t relax_tail(const uint32_t *targets, const int32_t *walks, uint32_t i, uint32_t n, int32_t base,
+                                  const int32_t *labels, uint32_t stride, uint32_t *out, uint32_t count) {
+    for (; i < n; ++i) {
+        if (base + walks[i] < labels[size_t(targets[i]) * stride]) out[count++] = i;
+    }
+    return count;
+}
+
+static uint32_t relax_footpaths_scalar(const uint32_t *targets, const int32_t *walks, uint32_t n, int32_t base,
+                                       const int32_t *labels, uint32_t stride, uint32_t *out) {
+    return relax_tail(targets, walks, 0, n, base, labels, stride, out, 0);
+}
+
+// Eight footpaths per vector; the improving lanes are appended from the mask.
+// Label indices target * stride are formed in 32 bits, as gathers take them.
+__attribute__((target("avx2")))
+static uint32_t relax_footpaths_avx2(const uint32_t *targets, const int32_t *walks, uint32_t n, int32_t base,
+                                     const int32_t *labels, uint32_t stride, uint32_t *out) {
+    const __m256i bases = _mm256_set1_epi32(base), strides = _mm256_set1_epi32(stride);
+    uint32_t count = 0, i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i index = _mm256_mullo_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(targets + i)), strides);
+        __m256i current = _mm256_i32gather_epi32(labels, index, 4);
+        __m256i walked = _mm256_add_epi32(bases, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(walks + i)));
+        unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(current, walked)));
+        for (; mask; mask &= mask - 1)
+            out[count++] = i + __builtin_ctz(mask);
+    }
+    return relax_tail(targets, walks, i, n, base, labels, stride, out, count);
+}
+
+// Sixteen footpaths per vector, the tail under a mask; improving lanes are
+// compressed straight into out.
+__attribute__((target("avx512f")))
+static uint32_t relax_footpaths_avx512(const uint32_t *targets, const int32_t *walks, uint32_t n, int32_t base,
+                                       const int32_t *labels, uint32_t stride, uint32_t *out) {
+    const __m512i bases = _mm512_set1_epi32(base), strides = _mm512_set1_epi32(stride);
+    const __m512i lane_numbers = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n; i += 16) {
+        __mmask16 lanes = n - i >= 16 ? 0xFFFF : (1u << (n - i)) - 1;
+        __m512i index = _mm512_mullo_epi32(_mm512_maskz_loadu_epi32(lanes, targets + i), strides);
+        __m512i current = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), lanes, index, labels, 4);
+        __m512i walked = _mm512_add_epi32(bases, _mm512_maskz_loadu_epi32(lanes, walks + i));
+        __mmask16 improved = _mm512_mask_cmplt_epi32_mask(lanes, walked, current);
+        _mm512_mask_compressstoreu_epi32(out + count, improved, _mm512_add_epi32(lane_numbers, _mm512_set1_epi32(i)));
+        count += __builtin_popcount(improved);
+    }
+    return count;
+}
+
+const vector<RelaxKernel> &relax_kernels() {
+    static const vector<RelaxKernel> kernels = [] {
+        __builtin_cpu_init();
+        return vector<RelaxKernel>{
+            { "scalar", relax_footpaths_scalar, true },
+            { "avx2", relax_footpaths_avx2, bool(__builtin_cpu_supports("avx2")) },
+            { "avx512", relax_footpaths_avx512, bool(__builtin_cpu_supports("avx512f")) },
+        };
+    }();
+    return kernels;
+}
+
+static const RelaxKernel &best_kernel() {
+    const auto &kernels = relax_kernels();
+    for (auto it = kernels.rbegin(); it != kernels.rend(); ++it) {
+        if (it->supported) return *it;
+    }
+    return kernels.front();
+}
+
+RelaxFootpathsFn relax_footpaths = best_kernel().fn;
+const char *relax_footpaths_name = best_kernel().name;
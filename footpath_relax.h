@@ -0,0 +1,28 @@
+#ifndef FOOTPATH_RELAX_H
+#define FOOTPATH_RELAX_H
+
+#include <cstdint>
+#include <vector>
+
+// Footpaths i in [0, n) lead to targets[i] and take walks[i] seconds, walked from
+// a stop reached at `base`. The label of stop s is labels[s * stride]. Writes to
+// `out`, in order, the i for which base + walks[i] is earlier than the target's
+// label, and returns how many there are. Targets must be distinct.
+typedef uint32_t (*RelaxFootpathsFn)(const uint32_t *targets, const int32_t *walks, uint32_t n, int32_t base,
+                                     const int32_t *labels, uint32_t stride, uint32_t *out);
+
+struct RelaxKernel {
+    const char *name;
+    RelaxFootpathsFn fn;
+    bool supported; // the CPU running us has the instructions this kernel needs
+};
+
+// Every compiled kernel (scalar, avx2, avx512), fastest last. The vector kernels
+// gather the targets' labels, add the walks to base and compare in one go.
+const std::vector<RelaxKernel> &relax_kernels();
+
+// Fastest supported kernel, chosen through CPUID when the program starts.
+extern RelaxFootpathsFn relax_footpaths;
+extern const char *relax_footpaths_name;
+
+#endif
@@ -0,0 +1,303 @@
+#include "footpaths.h"
+#include "gtfs.h"
+
+#include <cmath>
+#include <limits>
+#include <immintrin.h>
+#include <omp.h>
+
+using namespace std;
+
+// as in get_walking_distance()
+static const double EARTH_RADIUS = 6371000.0;
+
+// Cells are widened by this factor against rounding in get_walking_distance().
+static const double CELL_MARGIN = 1.001;
+// and the filters keep points whose bound is a little above the cutoff.
+static const double FILTER_MARGIN = 1.000001;
+
+// walking time of a stop Dijkstra has not reached
+static const int32_t NO_WALK = numeric_limits<int32_t>::max();
+
+static double to_degrees(double r) { return r * 180.0 / M_PI; }
+static double to_radians(double d) { return d * M_PI / 180.0; }
+
+// Largest haversine term of points at most max_distance apart.
+static double max_haversine_term(double max_distance) {
+    double half_angle = max_distance / (2 * EARTH_RADIUS);
+    if (half_angle >= M_PI / 2) return 2; // everything
+    return sin(half_angle) * sin(half_angle) * FILTER_MARGIN;
+}
+
+// Bound of the haversine term for coordinate differences in radians. Beyond
+// x = sqrt(3) the bound turns negative, which keeps the point, so it is safe
+// for any input. Longitudes differing by more than pi are closer the other way.
+static inline double haversine_bound(double dlat, double dlon, double cos_product) {
+    dlon = fabs(dlon);
+    dlon = min(dlon, 2 * M_PI - dlon);
+    double x = dlat * dlat * 0.25, y = dlon * dlon * 0.25;
+    return x * (1 - x * (1.0 / 3)) + cos_product * (y * (1 - y * (1.0 / 3)));
+}
+
+static uint32_t near_filter_tail(const double *lats, const double *lons, const double *cos_lats, uint32_t k, uint32_t n,
+                                 double lat, double lon, double cos_lat, double max_a, uint32_t *out, uint32_t count) {
+    for (; k < n; ++k) {
+        if (haversine_bound(lats[k] - lat, lons[k] - lon, cos_lat * cos_lats[k]) <= max_a) out[count++] = k;
+    }
+    return count;
+}
+
+static uint32_t near_filter_scalar(const double *lats, const double *lons, const double *cos_lats, uint32_t n,
+                                   double lat, double lon, double cos_lat, double max_a, uint32_t *out) {
+    return near_filter_tail(lats, lons, cos_lats, 0, n, lat, lon, cos_lat, max_a, out, 0);
+}
+
+// Four points per vector; the kept lanes are appended from the comparison mask.
+// Ends with vzeroupper, since the callers are SSE code.
+__attribute__((target("avx2"), noinline))
+static uint32_t near_filter_avx2(const double *lats, const double *lons, const double *cos_lats, uint32_t n,
+                                 double lat, double lon, double cos_lat, double max_a, uint32_t *out) {
+    const __m256d v_lat = _mm256_set1_pd(lat), v_lon = _mm256_set1_pd(lon);
+    const __m256d v_cos_lat = _mm256_set1_pd(cos_lat), v_max_a = _mm256_set1_pd(max_a);
+    const __m256d sign = _mm256_set1_pd(-0.0), two_pi = _mm256_set1_pd(2 * M_PI);
+    const __m256d quarter = _mm256_set1_pd(0.25), third = _mm256_set1_pd(1.0 / 3), one = _mm256_set1_pd(1.0);
+
+    uint32_t count = 0, k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256d dlat = _mm256_sub_pd(_mm256_loadu_pd(lats + k), v_lat);
+        __m256d dlon = _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_loadu_pd(lons + k), v_lon));
+        dlon = _mm256_min_pd(dlon, _mm256_sub_pd(two_pi, dlon));
+        __m256d x = _mm256_mul_pd(_mm256_mul_pd(dlat, dlat), quarter);
+        __m256d y = _mm256_mul_pd(_mm256_mul_pd(dlon, dlon), quarter);
+        __m256d bx = _mm256_mul_pd(x, _mm256_sub_pd(one, _mm256_mul_pd(x, third)));
+        __m256d by = _mm256_mul_pd(y, _mm256_sub_pd(one, _mm256_mul_pd(y, third)));
+        __m256d a = _mm256_add_pd(bx, _mm256_mul_pd(_mm256_mul_pd(v_cos_lat, _mm256_loadu_pd(cos_lats + k)), by));
+
+        unsigned mask = _mm256_movemask_pd(_mm256_cmp_pd(a, v_max_a, _CMP_LE_OQ));
+        for (; mask; mask &= mask - 1)
+            out[count++] = k + __builtin_ctz(mask);
+    }
+    _mm256_zeroupper();
+    return near_filter_tail(lats, lons, cos_lats, k, n, lat, lon, cos_lat, max_a, out, count);
+}
+
+const vector<NearFilterKernel> &near_filter_kernels() {
+    static const vector<NearFilterKernel> kernels = [] {
+        __builtin_cpu_init();
+        return vector<NearFilterKernel>{
+            { "scalar", near_filter_scalar, true },
+            { "avx2", near_filter_avx2, bool(__builtin_cpu_supports("avx2")) },
+        };
+    }();
+    return kernels;
+}
+
+static const NearFilterKernel &best_kernel() {
+    const auto &kernels = near_filter_kernels();
+    for (auto it = kernels.rbegin(); it != kernels.rend(); ++it) {
+        if (it->supported) return *it;
+    }
+    return kernels.front();
+}
+
+NearFilterFn near_filter = best_kernel().fn;
+const char *near_filter_name = best_kernel().name;
+
+// Two points within `radius` of each other are at most theta = radius / R
+// radians apart in latitude, since the haversine distance is at least R * dLat.
+// In longitude, sin^2(dLon/2) cos(lat1) cos(lat2) is part of the haversine sum,
+// so sin(dLon/2) <= sin(theta/2) / cos(lat) for the largest |lat| of either
+// point. Near the poles that bound is useless and the grid has one column.
+StopGrid::StopGrid(const StopPoints &p, double radius) {
+    const double theta = radius / EARTH_RADIUS;
+    cell_lat = to_degrees(theta) * CELL_MARGIN;
+
+    double max_lat = 0;
+    for (double lat : p.lats) max_lat = max(max_lat, fabs(lat));
+    double bound = sin(theta / 2) / cos(to_radians(max_lat)) * CELL_MARGIN;
+    columns = 1;
+    if (bound < 1) {
+        double min_cell_lon = to_degrees(2 * asin(bound)) * CELL_MARGIN;
+        columns = max<uint64_t>(1, uint64_t(360.0 / min_cell_lon));
+    }
+    cell_lon = 360.0 / columns;
+
+    vector<pair<uint64_t,uint32_t>> cells(p.size());
+    for (uint32_t i = 0; i < p.size(); ++i)
+        cells[i] = { row_of(p.lats[i]) * columns + column_of(p.lons[i]), i };
+    sort(cells.begin(), cells.end());
+
+    for (auto [key, i] : cells) {
+        keys.push_back(key);
+        stops.push_back(p.stops[i]);
+        lats.push_back(p.lats[i]);
+        lons.push_back(p.lons[i]);
+        lat_rads.push_back(to_radians(p.lats[i]));
+        lon_rads.push_back(to_radians(p.lons[i]));
+        cos_lats.push_back(latitude_cosine(p.lats[i]));
+    }
+}
+
+uint64_t StopGrid::row_of(double lat) const {
+    return uint64_t(max(0.0, floor((lat + 90.0) / cell_lat)));
+}
+
+uint64_t StopGrid::column_of(double lon) const {
+    double c = floor((lon + 180.0) / cell_lon);
+    int64_t column = int64_t(c) % int64_t(columns);
+    return column < 0 ? column + columns : column;
+}
+
+vector<pair<uint32_t,double>> StopGrid::within(double lat, double lon, double max_distance, NearFilterFn filter) const {
+    const double cos_lat = latitude_cosine(lat), lat_rad = to_radians(lat), lon_rad = to_radians(lon);
+    const double max_a = max_haversine_term(max_distance);
+
+    vector<pair<uint32_t,double>> result;
+    vector<uint32_t> near;
+    for_each_cell_around(lat, lon, [&](uint32_t begin, uint32_t end) {
+        near.resize(end - begin);
+        uint32_t count = filter(lat_rads.data() + begin, lon_rads.data() + begin, cos_lats.data() + begin, end - begin,
+                                lat_rad, lon_rad, cos_lat, max_a, near.data());
+        for (uint32_t k = 0; k < count; ++k) {
+            uint32_t slot = begin + near[k];
+            double dist = get_walking_distance(lat, lon, cos_lat, lats[slot], lons[slot], cos_lats[slot]);
+            if (dist <= max_distance) result.push_back({ slot, dist });
+        }
+    });
+    return result;
+}
+
+// The lower stop number goes first, as it did when every pair was measured in stop order.
+static void add_footpath(vector<Footpath> &footpaths, const StopGrid &grid, uint32_t s, uint32_t t, double max_distance) {
+    if (grid.stops[t] < grid.stops[s]) swap(s, t);
+    double dist = get_walking_distance(grid.lats[s], grid.lons[s], grid.cos_lats[s],
+                                       grid.lats[t], grid.lons[t], grid.cos_lats[t]);
+    if (dist <= max_distance)
+        footpaths.push_back({ grid.stops[s], grid.stops[t], int32_t(dist / WALK_SPEED) });
+}
+
+static vector<Footpath> join(vector<vector<Footpath>> &thread_footpaths) {
+    size_t total = 0;
+    for (auto &footpaths : thread_footpaths) total += footpaths.size();
+    vector<Footpath> all;
+    all.reserve(total);
+    for (auto &footpaths : thread_footpaths) {
+        all.insert(all.end(), footpaths.begin(), footpaths.end());
+        footpaths = vector<Footpath>();
+    }
+    return all;
+}
+
+vector<Footpath> find_footpaths(const StopPoints &points, double max_distance, NearFilterFn filter) {
+    StopGrid grid(points, max_distance);
+    const double max_a = max_haversine_term(max_distance);
+
+    vector<vector<Footpath>> thread_footpaths(omp_get_max_threads());
+    #pragma omp parallel
+    {
+        auto &footpaths = thread_footpaths[omp_get_thread_num()];
+        vector<uint32_t> near;
+
+        #pragma omp for schedule(dynamic, 64)
+        for (uint32_t s = 0; s < grid.size(); ++s) {
+            grid.for_each_cell_around(grid.lats[s], grid.lons[s], [&](uint32_t begin, uint32_t end) {
+                // each pair is measured from its lower slot
+                begin = max(begin, s + 1);
+                if (begin >= end) return;
+                if (near.size() < end - begin) near.resize(end - begin);
+                uint32_t count = filter(grid.lat_rads.data() + begin, grid.lon_rads.data() + begin, grid.cos_lats.data() + begin,
+                                        end - begin, grid.lat_rads[s], grid.lon_rads[s], grid.cos_lats[s], max_a, near.data());
+                for (uint32_t k = 0; k < count; ++k)
+                    add_footpath(footpaths, grid, s, begin + near[k], max_distance);
+            });
+        }
+    }
+    return join(thread_footpaths);
+}
+
+vector<Footpath> find_footpaths_all_pairs(const StopPoints &points, double max_distance) {
+    vector<vector<Footpath>> thread_footpaths(omp_get_max_threads());
+    #pragma omp parallel
+    {
+        auto &footpaths = thread_footpaths[omp_get_thread_num()];
+
+        #pragma omp for schedule(dynamic)
+        for (uint32_t i = 0; i < points.size(); ++i) {
+            for (uint32_t j = i + 1; j < points.size(); ++j) {
+                uint32_t from = i, to = j;
+                if (points.stops[to] < points.stops[from]) swap(from, to);
+                double dist = get_walking_distance(points.lats[from], points.lons[from], points.lats[to], points.lons[to]);
+                if (dist <= max_distance)
+                    footpaths.push_back({ points.stops[from], points.stops[to], int32_t(dist / WALK_SPEED) });
+            }
+        }
+    }
+    return join(thread_footpaths);
+}
+
+// Dijkstra from every stop, bounded by the budget or by the stop's longest
+// direct footpath, whichever is larger, so that direct neighbours get their
+// shortest walk too.
+vector<Footpath> close_footpaths(const vector<Footpath> &footpaths, uint32_t num_stops, int32_t budget) {
+    vector<uint32_t> offsets(num_stops + 1, 0);
+    for (auto &f : footpaths) {
+        ++offsets[f.from + 1];
+        ++offsets[f.to + 1];
+    }
+    for (uint32_t s = 0; s < num_stops; ++s)
+        offsets[s + 1] += offsets[s];
+    vector<pair<uint32_t,int32_t>> edges(offsets.back());
+    vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+    for (auto &f : footpaths) {
+        edges[next[f.from]++] = { f.to, f.walk_time };
+        edges[next[f.to]++] = { f.from, f.walk_time };
+    }
+
+    vector<vector<Footpath>> thread_footpaths(omp_get_max_threads());
+    #pragma omp parallel
+    {
+        auto &closed = thread_footpaths[omp_get_thread_num()];
+        vector<int32_t> walk(num_stops, NO_WALK);
+        vector<uint8_t> direct(num_stops, 0);
+        vector<uint32_t> reached;
+        vector<pair<int32_t,uint32_t>> heap;
+        auto later = [](const pair<int32_t,uint32_t> &a, const pair<int32_t,uint32_t> &b) { return a > b; };
+
+        #pragma omp for schedule(dynamic, 64)
+        for (uint32_t source = 0; source < num_stops; ++source) {
+            int32_t limit = budget;
+            for (uint32_t i = offsets[source]; i < offsets[source + 1]; ++i) {
+                limit = max(limit, edges[i].second);
+                direct[edges[i].first] = 1;
+            }
+
+            walk[source] = 0;
+            reached.push_back(source);
+            heap.push_back({ 0, source });
+            while (!heap.empty()) {
+                pop_heap(heap.begin(), heap.end(), later);
+                auto [time, stop] = heap.back();
+                heap.pop_back();
+                if (time > walk[stop]) continue;
+
+                if (stop > source && (time <= budget || direct[stop]))
+                    closed.push_back({ source, stop, time });
+                for (uint32_t i = offsets[stop]; i < offsets[stop + 1]; ++i) {
+                    auto [target, walk_time] = edges[i];
+                    int32_t arrival = time + walk_time;
+                    if (arrival > limit || arrival >= walk[target]) continue;
+                    if (walk[target] == NO_WALK) reached.push_back(target);
+                    walk[target] = arrival;
+                    heap.push_back({ arrival, target });
+                    push_heap(heap.begin(), heap.end(), later);
+                }
+            }
+
+            for (uint32_t stop : reached) walk[stop] = NO_WALK;
+            reached.clear();
+            for (uint32_t i = offsets[source]; i < offsets[source + 1]; ++i)
+                direct[edges[i].first] = 0;
+        }
+    }
+    return join(thread_footpaths);
+}
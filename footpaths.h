@@ -0,0 +1,122 @@
+#ifndef FOOTPATHS_H
+#define FOOTPATHS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Stops are linked by a footpath when get_walking_distance() puts them at most
+// MAX_WALK_DISTANCE metres apart; walking them takes distance / WALK_SPEED seconds.
+constexpr double MAX_WALK_DISTANCE = 1500.0;
+constexpr double WALK_SPEED = 1.4;
+
+// Located stops: point i is stop stops[i] at (lats[i], lons[i]), in degrees.
+struct StopPoints {
+    std::vector<uint32_t> stops;
+    std::vector<double> lats;
+    std::vector<double> lons;
+
+    size_t size() const { return stops.size(); }
+    void add(uint32_t stop, double lat, double lon) {
+        stops.push_back(stop);
+        lats.push_back(lat);
+        lons.push_back(lon);
+    }
+};
+
+// One footpath per pair of stops, listed once.
+struct Footpath {
+    uint32_t from, to;
+    int32_t walk_time;
+};
+
+// Lower bound on the haversine term a = sin^2(dLat/2) + cos(lat1) cos(lat2) sin^2(dLon/2)
+// between (lat, lon) and each point k of lats, lons, cos_lats[0..n), all in radians:
+// sin^2(x) >= x^2 (1 - x^2 / 3) turns it into an equirectangular distance with a
+// correction term. Writes the k whose bound is at most max_a to out and returns how
+// many there are; the points it leaves out are certainly farther than max_a.
+typedef uint32_t (*NearFilterFn)(const double *lats, const double *lons, const double *cos_lats, uint32_t n,
+                                 double lat, double lon, double cos_lat, double max_a, uint32_t *out);
+
+struct NearFilterKernel {
+    const char *name;
+    NearFilterFn fn;
+    bool supported; // the CPU running us has the instructions this kernel needs
+};
+
+// Every compiled kernel (scalar, avx2), fastest last.
+const std::vector<NearFilterKernel> &near_filter_kernels();
+
+// Fastest supported kernel, chosen through CPUID when the program starts.
+extern NearFilterFn near_filter;
+extern const char *near_filter_name;
+
+// Uniform lat/lon grid over a set of points. Cells are sized from the largest
+// latitude among the points so that any two points within `radius` metres of
+// each other lie in the same or in adjacent cells; columns wrap around the
+// antimeridian. The points are stored cell by cell as separate arrays, so that
+// the points of a cell are a slot range [begin, end) for the filter kernels.
+class StopGrid {
+public:
+    StopGrid(const StopPoints &points, double radius);
+
+    uint32_t size() const { return stops.size(); }
+
+    // Calls f(begin, end) with the slots of the cell of (lat, lon) and of the
+    // cells around it. They hold every point within `radius` of (lat, lon) when
+    // |lat| is at most the largest latitude of the points.
+    template <typename F>
+    void for_each_cell_around(double lat, double lon, F f) const;
+
+    // Slots of the points within max_distance <= radius of (lat, lon), each with
+    // the distance get_walking_distance() gives, in no particular order.
+    std::vector<std::pair<uint32_t,double>> within(double lat, double lon, double max_distance,
+                                                   NearFilterFn filter = near_filter) const;
+
+    // slot -> point, in degrees for get_walking_distance() and in radians for the filters
+    std::vector<uint32_t> stops;
+    std::vector<double> lats, lons;
+    std::vector<double> lat_rads, lon_rads, cos_lats; // cos_lats[i] is exactly the cosine get_walking_distance() takes
+
+private:
+    uint64_t row_of(double lat) const;
+    uint64_t column_of(double lon) const;
+
+    double cell_lat, cell_lon; // degrees
+    uint64_t columns;          // around the globe
+    std::vector<uint64_t> keys; // cell key (row * columns + column) of every slot, ascending
+};
+
+template <typename F>
+void StopGrid::for_each_cell_around(double lat, double lon, F f) const {
+    const uint64_t row = row_of(lat), column = column_of(lon);
+    const uint64_t num_columns = std::min<uint64_t>(columns, 3);
+    for (uint64_t r = row == 0 ? 0 : row - 1; r <= row + 1; ++r) {
+        for (uint64_t dc = 0; dc < num_columns; ++dc) {
+            // column - 1, column, column + 1, with each column visited once
+            uint64_t c = (column + columns - 1 + dc + (columns < 3)) % columns;
+            auto range = std::equal_range(keys.begin(), keys.end(), r * columns + c);
+            if (range.first != range.second) f(uint32_t(range.first - keys.begin()), uint32_t(range.second - keys.begin()));
+        }
+    }
+}
+
+// Every pair of points at most max_distance apart, with from < to as stop
+// numbers, in no particular order. The grid and the filter only narrow down the
+// pairs that are measured, so the result is that of find_footpaths_all_pairs().
+std::vector<Footpath> find_footpaths(const StopPoints &points, double max_distance, NearFilterFn filter = near_filter);
+
+// The same pairs, measuring every pair of points.
+std::vector<Footpath> find_footpaths_all_pairs(const StopPoints &points, double max_distance);
+
+// Transitive closure of the footpaths between stops [0, num_stops) within
+// `budget` seconds of walking: a pair of stops is linked when the shortest walk
+// between them over `footpaths` takes at most `budget`, or when `footpaths`
+// links them directly. Every pair is listed once, with from < to, and takes its
+// shortest walk, so direct footpaths that a chain of shorter walks beats are
+// shortened and parallel footpaths disappear. Walking one footpath of the
+// result then reaches every stop that walking any chain within budget does.
+std::vector<Footpath> close_footpaths(const std::vector<Footpath> &footpaths, uint32_t num_stops, int32_t budget);
+
+#endif
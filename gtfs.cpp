@@ -1,16 +1,19 @@
 #include "gtfs.h"
+#include "timetable.h"
+#include "gtfs_csv.h"
 
 #include <iostream>
 #include <fstream>
 #include <unordered_set>
 #include <cmath>
 #include <algorithm>
+#include <stdexcept>
 #include <omp.h>
-#include "csv.hpp"
 
 using namespace std;
 
 vector<StopTimeHeaders> df_stop_times;
+vector<string> df_stop_time_trips;
 vector<TripHeaders> df_trips;
 vector<RouteHeaders> df_routes;
 vector<StopHeaders> df_stops;
@@ -24,99 +27,71 @@ unordered_map<int, vector<pair<int,int>>> Transfers;
 vector<int> stop_ids;
 
 int gtfs_time_to_seconds(const string &time_str) {
-    int hours = 0, mins = 0, secs = 0;
-    sscanf(time_str.c_str(), "%d:%d:%d", &hours, &mins, &secs);
-    return hours*3600 + mins*60 + secs;
+    int seconds;
+    if (!parse_time_field(time_str, seconds))
+        throw runtime_error("Invalid GTFS time \"" + time_str + "\"");
+    return seconds;
 }
 
 static double to_rads(double d) { 
     return d * M_PI / 180.0; 
 }
 
-double get_walking_distance(double lat1, double lon1, double lat2, double lon2) {
+double latitude_cosine(double lat) {
+    return cos(to_rads(lat));
+}
+
+double get_walking_distance(double lat1, double lon1, double cos_lat1, double lat2, double lon2, double cos_lat2) {
     const double R = 6371000.0;
     double dLat = to_rads(lat2 - lat1);
     double dLon = to_rads(lon2 - lon1);
 
-    double a = sin(dLat/2)*sin(dLat/2) + cos(to_rads(lat1))*cos(to_rads(lat2)) * sin(dLon/2)*sin(dLon/2);
+    double a = sin(dLat/2)*sin(dLat/2) + cos_lat1*cos_lat2 * sin(dLon/2)*sin(dLon/2);
     double c = 2 * atan2(sqrt(a), sqrt(1-a));
     return R * c;
 }
 
-void load_stop_times(const string &path) {
-    csv::CSVReader reader(path);
-    vector<csv::CSVRow> rows;
-    for (auto& row : reader) {
-        rows.push_back(row);
-    }
-    df_stop_times.resize(rows.size());
-
-    #pragma omp parallel for num_threads(4)
-    for (int i = 0; i < rows.size(); ++i) {
-        StopTimeHeaders entry;
-
-        entry.trip_id = rows[i]["trip_id"].get<>();
-        entry.arrival_time = rows[i]["arrival_time"].get<>();
-        entry.departure_time = rows[i]["departure_time"].get<>();
-        entry.stop_id = rows[i]["stop_id"].get<int>();
+double get_walking_distance(double lat1, double lon1, double lat2, double lon2) {
+    return get_walking_distance(lat1, lon1, latitude_cosine(lat1), lat2, lon2, latitude_cosine(lat2));
+}
 
-        df_stop_times[i] = move(entry);
-    }
+// The GTFS tables are parsed straight from the mapped files, in parallel byte
+// ranges (gtfs_csv.h), rather than through csv.hpp row objects.
+void load_stop_times(const string &path) {
+    parse_stop_times(path, df_stop_times, df_stop_time_trips);
 }
 
 void load_trips(const string &path) {
-    csv::CSVReader reader(path);
-    vector<csv::CSVRow> rows;
-    for (auto& row : reader) {
-        rows.push_back(row);
-    }
-    df_trips.resize(rows.size());
-
-    #pragma omp parallel for num_threads(4)
-    for (size_t i = 0; i < rows.size(); ++i) {
-        TripHeaders entry;
-        entry.route_id  = rows[i]["route_id"].get<>();
-        entry.trip_id = rows[i]["trip_id"].get<>();
+    parse_trips(path, df_trips);
+}
 
-        df_trips[i] = move(entry);
-    }
+void parse_trips(const string &path, vector<TripHeaders> &rows) {
+    CsvFile file(path, { "route_id", "trip_id" });
+    file.parse_rows(rows, [](const string_view *fields, TripHeaders &entry) {
+        entry.route_id = fields[0];
+        entry.trip_id = fields[1];
+        return true;
+    });
 }
 
 void load_routes(const string &path) {
-    csv::CSVReader reader(path);
-    vector<csv::CSVRow> rows;
-    for (auto& row : reader) {
-        rows.push_back(row);
-    }
-    df_routes.resize(rows.size());
-
-    #pragma omp parallel for num_threads(4)
-    for (size_t i = 0; i < rows.size(); ++i) {
-        RouteHeaders entry;
-        entry.route_id = rows[i]["route_id"].get<>();
-
-        df_routes[i] = move(entry);
-    }
+    CsvFile file(path, { "route_id" });
+    file.parse_rows(df_routes, [](const string_view *fields, RouteHeaders &entry) {
+        entry.route_id = fields[0];
+        return true;
+    });
 }
 
 void load_stops(const string &path) {
-    csv::CSVReader reader(path);
-    vector<csv::CSVRow> rows;
-    for (auto& row : reader) {
-        rows.push_back(row);
-    }
-    df_stops.resize(rows.size());
-
-    #pragma omp parallel for num_threads(4)
-    for (size_t i = 0; i < rows.size(); ++i) {
-        StopHeaders entry;
-
-        entry.stop_id = rows[i]["stop_id"].get<int>();
-        entry.stop_lat = rows[i]["stop_lat"].get<double>();
-        entry.stop_lon = rows[i]["stop_lon"].get<double>();
+    parse_stops(path, df_stops);
+}
 
-        df_stops[i] = move(entry);
-    }
+void parse_stops(const string &path, vector<StopHeaders> &rows) {
+    CsvFile file(path, { "stop_id", "stop_lat", "stop_lon" });
+    file.parse_rows(rows, [](const string_view *fields, StopHeaders &entry) {
+        return parse_int_field(fields[0], entry.stop_id) && parse_double_field(fields[1], entry.stop_lat) &&
+               parse_double_field(fields[2], entry.stop_lon);
+    });
 }
 
 static vector<MergedRow> merge_stop_times_trips() {
@@ -124,17 +99,20 @@ static vector<MergedRow> merge_stop_times_trips() {
     for (auto &t : df_trips)
         trip_to_route[t.trip_id] = t.route_id;
 
+    vector<string> trip_routes(df_stop_time_trips.size());
+    for (size_t t = 0; t < df_stop_time_trips.size(); ++t) {
+        auto it = trip_to_route.find(df_stop_time_trips[t]);
+        if (it != trip_to_route.end()) trip_routes[t] = it->second;
+    }
+
     vector<MergedRow> merged(df_stop_times.size());
 
     #pragma omp parallel for num_threads(4)
     for (size_t i = 0; i < df_stop_times.size(); ++i) {
         auto &st = df_stop_times[i];
         MergedRow entry;
-        entry.trip_id = st.trip_id;
-        entry.route_id = trip_to_route[st.trip_id];
+        entry.route_id = trip_routes[st.trip];
         entry.stop_id = st.stop_id;
-        entry.arrival_time = st.arrival_time;
-        entry.departure_time = st.departure_time;
         merged[i] = move(entry);
     }
     return merged;
@@ -162,18 +140,13 @@ void build_trips() {
         Trips[t.trip_id] = entry;
     }
     
-    // create an map: trip_id -> stop_time indices (tldr group by trip_id) 
-    unordered_map<string, vector<size_t>> trip_to_indices;
-    trip_to_indices.reserve(Trips.size());
-    
-    for (size_t i = 0; i < df_stop_times.size(); ++i) {
-        trip_to_indices[df_stop_times[i].trip_id].push_back(i);
+    // group stop_time indices by trip; trips are already numbered by the parser
+    vector<pair<string, vector<size_t>>> trip_groups(df_stop_time_trips.size());
+    for (size_t t = 0; t < df_stop_time_trips.size(); ++t) {
+        trip_groups[t].first = df_stop_time_trips[t];
     }
-    
-    // can't parallelize unordered_map, so converting to vector of pairs instead
-    vector<pair<string, vector<size_t>>> trip_groups;
-    for (auto &kv : trip_to_indices) {
-        trip_groups.push_back(pair<string, vector<size_t>>(move(kv.first), move(kv.second)));
+    for (size_t i = 0; i < df_stop_times.size(); ++i) {
+        trip_groups[df_stop_times[i].trip].second.push_back(i);
     }
     
     #pragma omp parallel for num_threads(4)
@@ -185,10 +158,7 @@ void build_trips() {
         
         for (size_t idx : indices) {
             auto &row = df_stop_times[idx];
-            stops_dict[row.stop_id] = {
-                gtfs_time_to_seconds(row.arrival_time),
-                gtfs_time_to_seconds(row.departure_time)
-            };
+            stops_dict[row.stop_id] = { row.arrival_time, row.departure_time };
         }
         
         Trips[trip_id].stops = move(stops_dict);
@@ -236,8 +206,12 @@ void build_transfers() {
     }
 }
 
-void build_all(const string &base_dir) {
+void build_all(const string &base_dir, int32_t closure_budget) {
+
+    compile_timetable(base_dir, closure_budget);
+}
 
+void build_legacy_maps(const string &base_dir) {
     load_stop_times(base_dir + "/stop_times.txt");
     load_trips(base_dir + "/trips.txt");
     load_routes(base_dir + "/routes.txt");
@@ -1,17 +1,19 @@
 #ifndef GTFS_H
 #define GTFS_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
 #include <map>
 
+// Times are seconds past midnight; trip indexes df_stop_time_trips.
 struct StopTimeHeaders {
-    std::string trip_id;
-    std::string arrival_time;
-    std::string departure_time;
+    uint32_t trip;
     int stop_id;
+    int arrival_time;
+    int departure_time;
 };
 
 struct TripHeaders {
@@ -35,14 +37,12 @@ struct TripInfo {
 };
 
 struct MergedRow {
-    std::string trip_id;
     std::string route_id;
     int stop_id;
-    std::string arrival_time;
-    std::string departure_time;
 };
 
 extern std::vector<StopTimeHeaders> df_stop_times;
+extern std::vector<std::string> df_stop_time_trips; // trip ids in order of first appearance in stop_times.txt
 extern std::vector<TripHeaders> df_trips;
 extern std::vector<RouteHeaders> df_routes;
 extern std::vector<StopHeaders> df_stops;
@@ -65,14 +65,30 @@ extern std::unordered_map<int, std::vector<std::pair<int,int>>> Transfers;
 
 extern std::vector<int> stop_ids;
 
+// parse_time_field() of a GTFS time; throws runtime_error naming the time if
+// it is malformed.
 int gtfs_time_to_seconds(const std::string &time_str);
 double get_walking_distance(double lat1, double lon1, double lat2, double lon2);
 
+// The same distance with the latitude cosines given, as latitude_cosine() computes
+// them, for callers that measure one point against many.
+double get_walking_distance(double lat1, double lon1, double cos_lat1, double lat2, double lon2, double cos_lat2);
+double latitude_cosine(double lat);
+
 void load_stop_times(const std::string &path);
 void load_trips(const std::string &path);
 void load_routes(const std::string &path);
 void load_stops(const std::string &path);
 
-void build_all(const std::string &base_dir);
+void parse_trips(const std::string &path, std::vector<TripHeaders> &rows);
+void parse_stops(const std::string &path, std::vector<StopHeaders> &rows);
+
+// Builds the timetable TT used by queries (timetable.h), with its footpaths
+// closed over walks of up to closure_budget seconds if that is positive.
+void build_all(const std::string &base_dir, int32_t closure_budget = 0);
+
+// Loads the df_* tables and builds the maps above from them. Queries do not
+// need these; the unit tests and benchmarks use them as the reference.
+void build_legacy_maps(const std::string &base_dir);
 
 #endif
@@ -0,0 +1,219 @@
+#include "gtfs_csv.h"
+#include "gtfs.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+
+using namespace std;
+
+const char *split_csv_row(const char *p, const char *end, string_view *fields, size_t max_fields, size_t &count) {
+    count = 0;
+    while (true) {
+        const char *start = p;
+        if (p < end && *p == '"') {
+            for (++p; p < end; ++p) {
+                if (*p != '"') continue;
+                if (p + 1 < end && p[1] == '"') {
+                    ++p;
+                } else {
+                    ++p;
+                    break;
+                }
+            }
+        }
+        while (p < end && *p != ',' && *p != '\n') ++p;
+
+        const char *field_end = p;
+        if (field_end > start && field_end[-1] == '\r' && (p == end || *p == '\n')) --field_end;
+        if (count < max_fields) fields[count] = string_view(start, field_end - start);
+        ++count;
+
+        if (p == end) return end;
+        if (*p++ == '\n') return p;
+    }
+}
+
+string_view unquote(string_view field, string &scratch) {
+    if (field.empty() || field.front() != '"') return field;
+
+    field.remove_prefix(1);
+    if (!field.empty() && field.back() == '"') field.remove_suffix(1);
+    if (field.find("\"\"") == string_view::npos) return field;
+
+    scratch.clear();
+    for (size_t i = 0; i < field.size(); ++i) {
+        scratch.push_back(field[i]);
+        if (field[i] == '"' && i + 1 < field.size() && field[i + 1] == '"') ++i;
+    }
+    return scratch;
+}
+
+int csv_column(const string_view *header, size_t count, string_view name) {
+    string scratch;
+    for (size_t i = 0; i < count; ++i) {
+        string_view column = header[i];
+        while (!column.empty() && column.back() == ' ') column.remove_suffix(1);
+        while (!column.empty() && column.front() == ' ') column.remove_prefix(1);
+        if (unquote(column, scratch) == name) return i;
+    }
+    return -1;
+}
+
+static string_view trim(string_view field) {
+    while (!field.empty() && (field.front() == ' ' || field.front() == '\t')) field.remove_prefix(1);
+    while (!field.empty() && (field.back() == ' ' || field.back() == '\t')) field.remove_suffix(1);
+    return field;
+}
+
+// Unsigned decimal of `min_digits`..`max_digits` digits at the start of `field`.
+static bool parse_digits(string_view &field, size_t min_digits, size_t max_digits, int &value) {
+    size_t i = 0;
+    value = 0;
+    while (i < field.size() && i < max_digits && field[i] >= '0' && field[i] <= '9')
+        value = value * 10 + (field[i++] - '0');
+    field.remove_prefix(i);
+    return i >= min_digits;
+}
+
+bool parse_int_field(string_view field, int &value) {
+    field = trim(field);
+    bool negative = !field.empty() && field.front() == '-';
+    if (negative) field.remove_prefix(1);
+    if (!parse_digits(field, 1, 9, value) || !field.empty()) return false;
+    if (negative) value = -value;
+    return true;
+}
+
+bool parse_double_field(string_view field, double &value) {
+    field = trim(field);
+    if (!field.empty() && field.front() == '+') field.remove_prefix(1);
+    auto [end, error] = from_chars(field.data(), field.data() + field.size(), value);
+    return !field.empty() && error == errc() && end == field.data() + field.size();
+}
+
+CsvFile::CsvFile(const string &path, vector<string_view> names) : path(path) {
+    if (!file.open(path))
+        throw runtime_error("Cannot open " + path + ": " + strerror(errno));
+    file.advise_sequential();
+
+    const char *p = file.data();
+    end = file.data() + file.size();
+    if (end - p >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) p += 3;
+
+    size_t num_columns;
+    split_csv_row(p, end, nullptr, 0, num_columns);
+    vector<string_view> header(num_columns);
+    body = split_csv_row(p, end, header.data(), header.size(), num_columns);
+
+    for (string_view name : names) {
+        int column = csv_column(header.data(), header.size(), name);
+        if (column < 0)
+            throw runtime_error(path + " has no " + string(name) + " column");
+        columns.push_back(column);
+    }
+    used_columns = columns.empty() ? 1 : *max_element(columns.begin(), columns.end()) + 1;
+}
+
+vector<const char *> CsvFile::chunks(size_t max_chunks) const {
+    const size_t size = end - body;
+    const size_t num_chunks = max<size_t>(1, min(max_chunks, size / MIN_CHUNK_BYTES));
+
+    vector<const char *> bounds(num_chunks + 1);
+    for (size_t c = 0; c <= num_chunks; ++c)
+        bounds[c] = body + size * c / num_chunks;
+
+    // A newline only ends a row outside quotes. Whether a chunk starts inside
+    // quotes is the parity of the quotes before it, which the chunks count in
+    // parallel.
+    vector<uint8_t> in_quotes(num_chunks, 0);
+    if (num_chunks > 1) {
+        vector<size_t> quotes(num_chunks);
+        #pragma omp parallel for num_threads(num_chunks)
+        for (size_t c = 0; c < num_chunks; ++c)
+            quotes[c] = count_bytes('"', bounds[c], bounds[c + 1]);
+        for (size_t c = 1; c < num_chunks; ++c)
+            in_quotes[c] = (in_quotes[c - 1] + quotes[c - 1]) & 1;
+    }
+
+    #pragma omp parallel for num_threads(num_chunks)
+    for (size_t c = 1; c < num_chunks; ++c) {
+        const char *p = bounds[c];
+        bool quoted = in_quotes[c];
+        for (; p < end; ++p) {
+            if (*p == '"') {
+                quoted = !quoted;
+            } else if (*p == '\n' && !quoted) {
+                ++p;
+                break;
+            }
+        }
+        bounds[c] = p;
+    }
+    // a row longer than a chunk swallows the next chunk's start
+    for (size_t c = 1; c <= num_chunks; ++c)
+        bounds[c] = max(bounds[c], bounds[c - 1]);
+    return bounds;
+}
+
+size_t CsvFile::count_bytes(char c, const char *begin, const char *range_end) const {
+    size_t n = 0;
+    for (const char *p = begin; p < range_end; p += RELEASE_BYTES) {
+        const char *block_end = p + min<size_t>(RELEASE_BYTES, range_end - p);
+        n += count(p, block_end, c);
+        file.release(p, block_end);
+    }
+    return n;
+}
+
+// Trip ids of one chunk, numbered in order of first appearance in the chunk.
+// The deque keeps every id at a fixed address for the index to view.
+struct StopTimesChunk {
+    deque<string> trip_ids;
+    unordered_map<string_view, uint32_t> trip_index;
+    uint32_t last_trip = UINT32_MAX;
+};
+
+void parse_stop_times(const string &path, vector<StopTimeHeaders> &rows, vector<string> &trip_ids) {
+    CsvFile file(path, { "trip_id", "arrival_time", "departure_time", "stop_id" });
+
+    vector<StopTimesChunk> chunks;
+    vector<size_t> chunk_rows = file.parse_rows(rows, chunks, [](const string_view *fields, StopTimeHeaders &row, StopTimesChunk &chunk) {
+        // rows of a trip are usually contiguous, which spares most hash lookups
+        string_view trip = fields[0];
+        if (chunk.last_trip == UINT32_MAX || trip != chunk.trip_ids[chunk.last_trip]) {
+            auto it = chunk.trip_index.find(trip);
+            if (it == chunk.trip_index.end()) {
+                chunk.trip_ids.emplace_back(trip);
+                it = chunk.trip_index.emplace(chunk.trip_ids.back(), chunk.trip_ids.size() - 1).first;
+            }
+            chunk.last_trip = it->second;
+        }
+        row.trip = chunk.last_trip;
+        return parse_int_field(fields[3], row.stop_id) && parse_time_field(fields[1], row.arrival_time) &&
+               parse_time_field(fields[2], row.departure_time);
+    });
+
+    // Numbering the chunks' trips chunk by chunk keeps the order of first
+    // appearance in the file; rows are then renumbered in parallel.
+    trip_ids.clear();
+    unordered_map<string_view, uint32_t> trip_index;
+    vector<vector<uint32_t>> global_trips(chunks.size());
+    for (size_t c = 0; c < chunks.size(); ++c) {
+        for (const string &trip : chunks[c].trip_ids) {
+            auto [it, inserted] = trip_index.try_emplace(trip, trip_ids.size());
+            if (inserted) trip_ids.push_back(trip);
+            global_trips[c].push_back(it->second);
+        }
+    }
+
+    #pragma omp parallel for num_threads(chunks.size())
+    for (size_t c = 0; c < chunks.size(); ++c) {
+        for (size_t r = chunk_rows[c]; r < chunk_rows[c + 1]; ++r)
+            rows[r].trip = global_trips[c][rows[r].trip];
+    }
+}
@@ -0,0 +1,194 @@
+#ifndef GTFS_CSV_H
+#define GTFS_CSV_H
+
+#include "mapped_file.h"
+#include "time_parse.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <omp.h>
+
+struct StopTimeHeaders;
+
+// Allocation-free CSV scanning over a mapped file, for the GTFS tables that are
+// too large to go through csv.hpp row objects. Fields are string_views into the
+// mapping; quoted fields keep their quotes until unquote() is called on them.
+
+// Splits the row starting at `p` into at most `max_fields` fields and returns the
+// start of the next row. `count` is the number of fields in the row, which may be
+// larger than `max_fields`. Quoted fields may contain commas and line breaks.
+const char *split_csv_row(const char *p, const char *end, std::string_view *fields, size_t max_fields, size_t &count);
+
+// Field contents without surrounding quotes. Only fields with escaped quotes ("")
+// are copied, into `scratch`; everything else stays a view of the field.
+std::string_view unquote(std::string_view field, std::string &scratch);
+
+// Column of `name` in a header row, or -1.
+int csv_column(const std::string_view *header, size_t count, std::string_view name);
+
+// Integer and decimal fields, surrounding blanks allowed; false if malformed.
+// Time fields are parsed by time_parse.h.
+bool parse_int_field(std::string_view field, int &value);
+bool parse_double_field(std::string_view field, double &value);
+
+// A mapped CSV file whose rows are parsed in parallel: the body is split into
+// byte ranges that start on row boundaries, every range is parsed by its own
+// thread straight into its slice of the output, and the slices are closed up in
+// file order.
+class CsvFile {
+public:
+    // Maps `path` and finds `columns` in its header. Throws std::runtime_error
+    // if the file cannot be mapped or lacks one of the columns.
+    CsvFile(const std::string &path, std::vector<std::string_view> columns);
+
+    // Splits the rows into at most `max_chunks` ranges of similar size, none
+    // smaller than MIN_CHUNK_BYTES unless the file is. Range i is
+    // [bounds[i], bounds[i+1]). Row boundaries are found outside quoted fields.
+    std::vector<const char *> chunks(size_t max_chunks) const;
+
+    // Parses every row into `rows`, in file order, on all OpenMP threads.
+    // parse(fields, row, state) gets the unquoted fields of the requested columns
+    // in the order they were requested and returns false if the row is malformed;
+    // states[i] is private to chunk i. Returns the first row of every chunk,
+    // followed by rows.size(). Throws std::runtime_error on malformed rows.
+    template <typename Row, typename State, typename F>
+    std::vector<size_t> parse_rows(std::vector<Row> &rows, std::vector<State> &states, F parse) const;
+
+    template <typename Row, typename F>
+    void parse_rows(std::vector<Row> &rows, F parse) const {
+        std::vector<char> states;
+        parse_rows(rows, states, [&](const std::string_view *fields, Row &row, char &) { return parse(fields, row); });
+    }
+
+    // Calls scan(fields, state) for every row on all OpenMP threads, with
+    // states[i] private to chunk i; chunks follow each other in file order and
+    // rows are visited in order within a chunk. states[i] is constructed from
+    // the line count of chunk i, an upper bound on its rows, so that it can
+    // size its buffers once. scan returns false if the row is malformed.
+    // Throws std::runtime_error on malformed rows.
+    template <typename State, typename F>
+    void scan_rows(std::vector<State> &states, F scan) const;
+
+    static const size_t MIN_CHUNK_BYTES = 1 << 20;
+    static const size_t RELEASE_BYTES = 4 << 20;
+
+private:
+    // Occurrences of `c` in [begin, range_end); pages it read leave the resident set.
+    size_t count_bytes(char c, const char *begin, const char *range_end) const;
+
+    // Calls f(fields) for the rows in [begin, chunk_end) until it returns false.
+    // Returns the error for the first malformed row, or an empty string.
+    template <typename F>
+    std::string scan_chunk(const char *begin, const char *chunk_end, F f) const;
+
+    std::string path;
+    MappedFile file;
+    const char *body;  // first row after the header
+    const char *end;
+    std::vector<int> columns;
+    size_t used_columns; // fields to split per row: up to the last requested column
+};
+
+template <typename Row, typename State, typename F>
+std::vector<size_t> CsvFile::parse_rows(std::vector<Row> &rows, std::vector<State> &states, F parse) const {
+    const std::vector<const char *> bounds = chunks(omp_get_max_threads());
+    const size_t num_chunks = bounds.size() - 1;
+    states.assign(num_chunks, State());
+
+    // a chunk has at most one row per line, which sizes the output once
+    std::vector<size_t> starts(num_chunks + 1, 0);
+    #pragma omp parallel for num_threads(num_chunks)
+    for (size_t c = 0; c < num_chunks; ++c)
+        starts[c + 1] = count_bytes('\n', bounds[c], bounds[c + 1]) + 1;
+    for (size_t c = 0; c < num_chunks; ++c)
+        starts[c + 1] += starts[c];
+    rows.clear();
+    rows.resize(starts[num_chunks]);
+
+    std::vector<size_t> ends(num_chunks);
+    std::vector<std::string> errors(num_chunks);
+    #pragma omp parallel for num_threads(num_chunks) schedule(dynamic, 1)
+    for (size_t c = 0; c < num_chunks; ++c) {
+        size_t r = starts[c];
+        errors[c] = scan_chunk(bounds[c], bounds[c + 1], [&](const std::string_view *fields) {
+            return parse(fields, rows[r++], states[c]);
+        });
+        ends[c] = r;
+    }
+    for (const std::string &error : errors) {
+        if (!error.empty()) throw std::runtime_error(error);
+    }
+
+    // close the gaps left by blank lines and quoted line breaks
+    size_t out = 0;
+    for (size_t c = 0; c < num_chunks; ++c) {
+        size_t chunk_rows = ends[c] - starts[c];
+        if (out != starts[c])
+            std::move(rows.begin() + starts[c], rows.begin() + ends[c], rows.begin() + out);
+        starts[c] = out;
+        out += chunk_rows;
+    }
+    starts[num_chunks] = out;
+    rows.resize(out);
+    return starts;
+}
+
+template <typename State, typename F>
+void CsvFile::scan_rows(std::vector<State> &states, F scan) const {
+    const std::vector<const char *> bounds = chunks(omp_get_max_threads());
+    const size_t num_chunks = bounds.size() - 1;
+    states.clear();
+    states.resize(num_chunks);
+
+    std::vector<std::string> errors(num_chunks);
+    #pragma omp parallel for num_threads(num_chunks) schedule(dynamic, 1)
+    for (size_t c = 0; c < num_chunks; ++c) {
+        states[c] = State(count_bytes('\n', bounds[c], bounds[c + 1]) + 1);
+        errors[c] = scan_chunk(bounds[c], bounds[c + 1], [&](const std::string_view *fields) {
+            return scan(fields, states[c]);
+        });
+    }
+    for (const std::string &error : errors) {
+        if (!error.empty()) throw std::runtime_error(error);
+    }
+}
+
+template <typename F>
+std::string CsvFile::scan_chunk(const char *begin, const char *chunk_end, F f) const {
+    std::vector<std::string_view> fields(used_columns), values(columns.size());
+    std::vector<std::string> scratch(columns.size());
+    const char *p = begin, *released = begin;
+    try {
+        while (p < chunk_end) {
+            // rows are not read again, so parsed pages leave the resident set as we go
+            if (size_t(p - released) >= RELEASE_BYTES) {
+                file.release(released, p);
+                released = p;
+            }
+
+            const char *row_start = p;
+            size_t count;
+            p = split_csv_row(p, chunk_end, fields.data(), used_columns, count);
+            if (count == 1 && fields[0].empty()) continue;
+
+            bool parsed = count >= used_columns;
+            for (size_t i = 0; parsed && i < columns.size(); ++i)
+                values[i] = unquote(fields[columns[i]], scratch[i]);
+            if (!parsed || !f(values.data()))
+                return path + ": malformed row at byte " + std::to_string(row_start - file.data());
+        }
+    } catch (const std::exception &e) {
+        return path + ": " + e.what();
+    }
+    return "";
+}
+
+// Parses stop_times.txt with CsvFile. Trip ids are interned into `trip_ids` in
+// order of first appearance and rows refer to them by index. Throws
+// std::runtime_error if the file is missing, lacks a column or has a malformed row.
+void parse_stop_times(const std::string &path, std::vector<StopTimeHeaders> &rows, std::vector<std::string> &trip_ids);
+
+#endif
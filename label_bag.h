@@ -0,0 +1,90 @@
+#ifndef LABEL_BAG_H
+#define LABEL_BAG_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Pareto set of labels under Label::dominates(a, b), which must be a partial
+// order on the label's criteria; no label of the bag dominates another. Up
+// to N labels are kept in the bag itself, so that most bags are read without
+// leaving their cache lines; past N they move to a heap array, which clear()
+// keeps for the next time. The bag holds only a pointer to that array, so
+// that it is N labels and 16 bytes.
+template <typename Label, uint32_t N>
+class LabelBag {
+public:
+    LabelBag() = default;
+    LabelBag(const LabelBag &other) { *this = other; }
+    LabelBag(LabelBag &&) = default;
+    LabelBag &operator=(LabelBag &&) = default;
+    LabelBag &operator=(const LabelBag &other) {
+        if (this == &other) return *this;
+        std::copy(other.local, other.local + (other.spilled ? 0 : other.count), local);
+        count = other.count;
+        spilled = other.spilled;
+        spill.reset(other.spill ? new std::vector<Label>(*other.spill) : nullptr);
+        return *this;
+    }
+
+    uint32_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const Label *begin() const { return data(); }
+    const Label *end() const { return data() + count; }
+
+    // Some label of the bag is at least as good as `label` in every criterion.
+    bool dominates(const Label &label) const {
+        for (const Label &l : *this)
+            if (Label::dominates(l, label)) return true;
+        return false;
+    }
+
+    // Adds `label` and drops the labels it dominates, in a single pass; false,
+    // and the bag unchanged, if a label of the bag dominates it. A label the
+    // pass dropped before finding one that dominates `label` would be
+    // dominated by that one too, which the bag never holds.
+    bool insert(const Label &label) {
+        Label *labels = data();
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (Label::dominates(labels[i], label)) return false;
+            if (!Label::dominates(label, labels[i])) labels[kept++] = labels[i];
+        }
+        count = kept;
+        push_back(label);
+        return true;
+    }
+
+    void clear() {
+        count = 0;
+        spilled = false;
+        if (spill) spill->clear();
+    }
+
+private:
+    Label *data() { return spilled ? spill->data() : local; }
+    const Label *data() const { return spilled ? spill->data() : local; }
+
+    void push_back(const Label &label) {
+        if (!spilled && count == N) {
+            if (!spill) spill.reset(new std::vector<Label>());
+            spill->assign(local, local + N);
+            spilled = true;
+        }
+        if (spilled) {
+            spill->resize(count);
+            spill->push_back(label);
+        } else {
+            local[count] = label;
+        }
+        ++count;
+    }
+
+    Label local[N];
+    uint32_t count = 0;
+    bool spilled = false;
+    std::unique_ptr<std::vector<Label>> spill; // every label once spilled
+};
+
+#endif
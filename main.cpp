@@ -9,6 +9,16 @@
 #include <cassert>
 #include "gtfs.h"
 #include "raptor.h"
+#include "raptor_range.h"
+#include "mc_raptor.h"
+#include "timetable.h"
+#include "bench.h"
+#include "trip_search.h"
+#include "snapshot.h"
+#include "time_parse.h"
+#include "footpaths.h"
+#include "footpath_relax.h"
+#include "csv.hpp"
 
 
 namespace fs = std::filesystem;
@@ -77,6 +87,47 @@ void conduct_unit_tests(string dataset) {
 
     cout << "Assert passed - CSV row counts match data structures." << endl;
 
+    csv::CSVReader stop_times_reader(dataset + "/stop_times.txt");
+    size_t stop_time_row = 0;
+    for (auto &row : stop_times_reader) {
+        assert(stop_time_row < df_stop_times.size());
+        const StopTimeHeaders &stop_time = df_stop_times[stop_time_row++];
+        assert(df_stop_time_trips[stop_time.trip] == row["trip_id"].get<>());
+        assert(stop_time.stop_id == row["stop_id"].get<int>());
+        assert(stop_time.arrival_time == gtfs_time_to_seconds(row["arrival_time"].get<>()));
+        assert(stop_time.departure_time == gtfs_time_to_seconds(row["departure_time"].get<>()));
+    }
+    assert(stop_time_row == df_stop_times.size());
+    cout << "Assert passed - mapped stop_times parser matches csv.hpp for " << stop_time_row << " rows\n";
+
+    vector<string_view> time_fields = { "08:00:00", "23:59:59", "25:01:02", "", " 8:05:03 ", "123:00:00",
+                                        "8:5:3", "00:00:00", "12:34:56", "99:59:59", "07:30:00", "10:00:0" };
+    vector<int32_t> expected_seconds = { 28800, 86399, 90062, 0, 29103, 442800,
+                                         29103, 0, 45296, 359999, 27000, 36000 };
+    vector<string> random_times;
+    mt19937 time_gen(1);
+    for (int i = 0; i < 1000; ++i) {
+        int t = uniform_int_distribution<int>(0, 48 * 3600 - 1)(time_gen);
+        random_times.push_back(seconds_to_time(t));
+        expected_seconds.push_back(t);
+    }
+    time_fields.insert(time_fields.end(), random_times.begin(), random_times.end());
+    for (const auto &kernel : time_column_kernels()) {
+        if (!kernel.supported) continue;
+        // every offset exercises the vector kernels' groups and tails
+        for (size_t start = 0; start < 8; ++start) {
+            vector<int32_t> seconds(time_fields.size());
+            assert(kernel.fn(time_fields.data() + start, time_fields.size() - start, seconds.data()) == time_fields.size() - start);
+            assert(equal(seconds.begin(), seconds.end() - start, expected_seconds.begin() + start));
+        }
+        for (string_view malformed : { "08:00:0x", "08-00-00", "8:00", "ab:cd:ef", "08:00:00:00" }) {
+            vector<string_view> column = { "08:00:00", "09:00:00", "10:00:00", malformed, "11:00:00" };
+            int32_t seconds[5];
+            assert(kernel.fn(column.data(), column.size(), seconds) == 3);
+        }
+    }
+    cout << "Assert passed - " << parse_time_column_name << " time kernel matches expected seconds\n";
+
     vector<int> stop_ids;
     stop_ids.reserve(StopRoutes.size());
     for (const auto &stop : StopRoutes) {
@@ -128,6 +179,115 @@ void conduct_unit_tests(string dataset) {
     }
     cout << "Assert passed - RouteTrips entries validated for 5 random routes\n";
 
+    assert(TT.num_stops() == StopCoords.size());
+    assert(TT.num_trips() <= Trips.size());
+
+    uniform_int_distribution<uint32_t> dist4(0, TT.num_trips() - 1);
+    for (int i = 0; i < 5; ++i) {
+        uint32_t trip = dist4(gen);
+        uint32_t pattern = TT.trip_patterns[trip];
+        const TripInfo &trip_info = Trips.at(string(TT.trip_ids[trip]));
+        assert(TT.route_ids[TT.pattern_routes[pattern]] == trip_info.info.at("route_id"));
+
+        // later visits of a stop overwrite earlier ones, as in Trips
+        unordered_map<int, pair<int,int>> pattern_stop_times;
+        for (uint32_t pos = 0; pos < TT.pattern_size(pattern); ++pos) {
+            int stop_id = TT.stop_ids[TT.stops_of(pattern)[pos]];
+            pattern_stop_times[stop_id] = { TT.arrival(trip, pos), TT.departure(trip, pos) };
+        }
+        assert(pattern_stop_times == trip_info.stops);
+    }
+    cout << "Assert passed - compiled patterns match Trips for 5 random trips\n";
+
+    for (uint32_t stop = 0; stop < TT.num_stops() && TT.transfer_closure == 0; ++stop) {
+        vector<pair<int,int>> compiled;
+        for (uint32_t i = TT.transfer_offsets[stop]; i < TT.transfer_offsets[stop + 1]; ++i)
+            compiled.push_back({ TT.stop_ids[TT.transfer_targets[i]], TT.transfer_walk_times[i] });
+        vector<pair<int,int>> expected_transfers = Transfers[TT.stop_ids[stop]];
+        sort(compiled.begin(), compiled.end());
+        sort(expected_transfers.begin(), expected_transfers.end());
+        assert(compiled == expected_transfers);
+    }
+
+    // clusters around a city, across the antimeridian and near a pole
+    StopPoints points;
+    for (auto [lat, lon] : { pair<double,double>{ 41.88, -87.63 }, { -17.7, 179.99 }, { 89.95, 0.0 } }) {
+        uniform_real_distribution<double> offset(-0.05, 0.05);
+        for (int i = 0; i < 400; ++i) {
+            double point_lon = lon + offset(gen);
+            if (point_lon > 180) point_lon -= 360;
+            points.add(points.size(), lat + offset(gen) / 5, point_lon);
+        }
+    }
+    auto footpath_pairs = [](vector<Footpath> footpaths) {
+        vector<tuple<uint32_t,uint32_t,int32_t>> pairs;
+        for (auto &f : footpaths) pairs.push_back({ f.from, f.to, f.walk_time });
+        sort(pairs.begin(), pairs.end());
+        return pairs;
+    };
+    auto all_pairs = footpath_pairs(find_footpaths_all_pairs(points, MAX_WALK_DISTANCE));
+    assert(!all_pairs.empty());
+    for (const auto &kernel : near_filter_kernels()) {
+        if (kernel.supported) assert(footpath_pairs(find_footpaths(points, MAX_WALK_DISTANCE, kernel.fn)) == all_pairs);
+    }
+
+    // lookups around arbitrary points find exactly the stops in range
+    StopGrid grid(points, MAX_WALK_DISTANCE);
+    for (int i = 0; i < 100; ++i) {
+        uint32_t near_point = gen() % points.size();
+        double lat = points.lats[near_point] + uniform_real_distribution<double>(-0.01, 0.01)(gen);
+        double lon = points.lons[near_point] + uniform_real_distribution<double>(-0.01, 0.01)(gen);
+        double radius = uniform_real_distribution<double>(0, MAX_WALK_DISTANCE)(gen);
+
+        vector<uint32_t> expected_stops;
+        for (uint32_t j = 0; j < points.size(); ++j) {
+            if (get_walking_distance(lat, lon, points.lats[j], points.lons[j]) <= radius) expected_stops.push_back(points.stops[j]);
+        }
+        for (const auto &kernel : near_filter_kernels()) {
+            if (!kernel.supported) continue;
+            vector<uint32_t> found_stops;
+            for (auto [slot, dist] : grid.within(lat, lon, radius, kernel.fn)) {
+                assert(dist == get_walking_distance(lat, lon, grid.lats[slot], grid.lons[slot]));
+                found_stops.push_back(grid.stops[slot]);
+            }
+            sort(found_stops.begin(), found_stops.end());
+            assert(found_stops == expected_stops);
+        }
+    }
+    cout << "Assert passed - grid footpaths with the " << near_filter_name
+         << " distance filter match all-pairs footpaths and legacy Transfers\n";
+
+    // the closure of the city cluster against Floyd-Warshall over its footpaths
+    const uint32_t city_points = 400;
+    const int32_t closure_budget = 1800;
+    vector<Footpath> city_footpaths;
+    for (auto &f : find_footpaths(points, MAX_WALK_DISTANCE)) {
+        if (f.to < city_points) city_footpaths.push_back(f);
+    }
+    vector<vector<int32_t>> shortest(city_points, vector<int32_t>(city_points, NO_TIME));
+    vector<vector<uint8_t>> linked(city_points, vector<uint8_t>(city_points, 0));
+    for (auto &f : city_footpaths) {
+        shortest[f.from][f.to] = shortest[f.to][f.from] = min(shortest[f.from][f.to], f.walk_time);
+        linked[f.from][f.to] = 1;
+    }
+    for (uint32_t via = 0; via < city_points; ++via) {
+        for (uint32_t i = 0; i < city_points; ++i) {
+            if (shortest[i][via] == NO_TIME) continue;
+            for (uint32_t j = 0; j < city_points; ++j) {
+                if (shortest[via][j] != NO_TIME) shortest[i][j] = min(shortest[i][j], shortest[i][via] + shortest[via][j]);
+            }
+        }
+    }
+    vector<tuple<uint32_t,uint32_t,int32_t>> expected_closure;
+    for (uint32_t i = 0; i < city_points; ++i) {
+        for (uint32_t j = i + 1; j < city_points; ++j) {
+            if (shortest[i][j] <= closure_budget || linked[i][j]) expected_closure.push_back({ i, j, shortest[i][j] });
+        }
+    }
+    auto closure = footpath_pairs(close_footpaths(city_footpaths, city_points, closure_budget));
+    assert(closure == expected_closure && closure.size() > city_footpaths.size());
+    cout << "Assert passed - footpaths closed within " << closure_budget << " s match Floyd-Warshall\n";
+
     vector<string> routes;
     for (const auto& route : RouteStops) {
         if (!route.second.empty()) {
@@ -143,11 +303,304 @@ void conduct_unit_tests(string dataset) {
     int board_time = 0;
 
     auto expected = expected_earliest_trip(test_route, board_stop, board_time);
-    string found_trip = earliest_trip(test_route, board_stop, board_time);
+
+    // the route's earliest trip is the best over its patterns, boarding at the last visit as Trips does
+    uint32_t test_route_idx = route_index(test_route);
+    string found_trip = "";
+    int found_dep = numeric_limits<int>::max();
+    for (uint32_t p = 0; p < TT.num_patterns(); ++p) {
+        if (TT.pattern_routes[p] != test_route_idx) continue;
+
+        int pos = -1;
+        for (uint32_t i = 0; i < TT.pattern_size(p); ++i) {
+            if (TT.stop_ids[TT.stops_of(p)[i]] == board_stop) pos = i;
+        }
+        if (pos < 0) continue;
+
+        uint32_t trip = earliest_trip(p, pos, board_time);
+        if (trip != NO_INDEX && TT.departure(trip, pos) < found_dep) {
+            found_dep = TT.departure(trip, pos);
+            found_trip = string(TT.trip_ids[trip]);
+        }
+    }
 
     assert(expected.first.find(found_trip) != expected.first.end());
     cout << "Assert passed - earliest_trip returned expected trip id for route " << test_route << '\n';
 
+    uniform_int_distribution<uint32_t> dist5(0, TT.num_patterns() - 1);
+    uniform_int_distribution<int> time_dist(0, 30 * 3600);
+    for (int i = 0; i < 1000; ++i) {
+        uint32_t p = dist5(gen);
+        uint32_t pos = gen() % TT.pattern_size(p);
+        const int32_t *departures = TT.stop_departures(p, pos);
+        assert(is_sorted(departures, departures + TT.pattern_trip_count(p)));
+
+        int t = time_dist(gen);
+        uint32_t hint = TT.pattern_trip_offsets[p] + gen() % TT.pattern_trip_count(p);
+        assert(earliest_trip(p, pos, t, hint) == earliest_trip(p, pos, t));
+
+        uint32_t expected_idx = lower_bound(departures, departures + TT.pattern_trip_count(p), t) - departures;
+        for (const auto &kernel : search_kernels()) {
+            if (kernel.supported) assert(kernel.fn(departures, TT.pattern_trip_count(p), t) == expected_idx);
+        }
+    }
+    for (uint32_t n = 0; n < 300; ++n) {
+        vector<int32_t> column(n);
+        for (uint32_t j = 0; j < n; ++j) column[j] = 10 * (j / 3);
+
+        for (int t = -5; t <= int(n) * 4; t += 5) {
+            uint32_t expected_idx = lower_bound(column.begin(), column.end(), t) - column.begin();
+            for (const auto &kernel : search_kernels()) {
+                if (kernel.supported) assert(kernel.fn(column.data(), n, t) == expected_idx);
+            }
+        }
+    }
+    cout << "Assert passed - FIFO departure columns, galloping earliest_trip and " << first_at_least_name
+         << " search kernels validated for 1000 random searches\n";
+
+    assert(TT.stop_patterns.size() == TT.pattern_stops.size() && TT.stop_pattern_positions.size() == TT.pattern_stops.size());
+    for (uint32_t p = 0; p < TT.num_patterns(); ++p) {
+        const uint32_t *stops = TT.stops_of(p);
+        for (uint32_t i = 0; i < TT.pattern_size(p); ++i) {
+            const uint32_t first = TT.stop_pattern_offsets[stops[i]], last = TT.stop_pattern_offsets[stops[i] + 1];
+            uint32_t visits = 0;
+            for (uint32_t j = first; j < last; ++j) visits += TT.stop_patterns[j] == p && TT.stop_pattern_positions[j] == i;
+            assert(visits == 1);
+        }
+    }
+    cout << "Assert passed - every stop of every pattern indexed once with its position\n";
+
+    const uint32_t label_stride = 3;
+    vector<int32_t> labels(size_t(TT.num_stops()) * label_stride);
+    vector<uint32_t> improved(TT.transfer_targets.size()), expected_improved(TT.transfer_targets.size());
+    for (uint32_t stop = 0; stop < TT.num_stops(); ++stop) {
+        const uint32_t first = TT.transfer_offsets[stop], n = TT.transfer_offsets[stop + 1] - first;
+        const uint32_t *targets = TT.transfer_targets.data() + first;
+        const int32_t *walks = TT.transfer_walk_times.data() + first;
+        assert(is_sorted(walks, walks + n));
+
+        for (int32_t &label : labels) label = gen() % 4 == 0 ? NO_TIME : time_dist(gen);
+        int32_t base = time_dist(gen);
+        uint32_t expected_count = 0;
+        for (uint32_t i = 0; i < n; ++i) {
+            if (base + walks[i] < labels[size_t(targets[i]) * label_stride + 1]) expected_improved[expected_count++] = i;
+        }
+        for (const auto &kernel : relax_kernels()) {
+            if (!kernel.supported) continue;
+            uint32_t count = kernel.fn(targets, walks, n, base, labels.data() + 1, label_stride, improved.data());
+            assert(count == expected_count && equal(improved.begin(), improved.begin() + count, expected_improved.begin()));
+        }
+    }
+    cout << "Assert passed - footpaths ordered by walk time and " << relax_footpaths_name
+         << " relaxation kernel validated at every stop\n";
+
+    QueryWorkspace workspace;
+    uniform_int_distribution<uint32_t> stop_dist(0, TT.num_stops() - 1);
+    uniform_int_distribution<int> day_dist(36000, 64800);
+    int journeys = 0;
+    for (int i = 0; i < 100; ++i) {
+        int source = TT.stop_ids[stop_dist(gen)], dest = TT.stop_ids[stop_dist(gen)];
+        int departure = day_dist(gen);
+        Pruning pruning = i % 2 ? Pruning::full : Pruning::none;
+        Journey journey = raptor_journey(workspace, source, dest, departure, 5, pruning);
+        int arrival = journey.arrival();
+        vector<PathStep> path = journey.path();
+        assert(!workspace.log.empty());
+        auto [written_arrival, written_path] = raptor(source, dest, departure, 5, pruning);
+        assert(journey.num_legs() == path.size() && written_arrival == arrival && written_path.size() == path.size());
+
+        // each step starts where and after the previous one ends
+        if (arrival != -1) {
+            int stop = source, time = departure, trips = 0;
+            for (const PathStep &step : path) {
+                assert(step.stop1 == stop && step.start_time >= time && step.end_time >= step.start_time);
+                if (step.type == LegType::walk) assert(step.end_time == step.start_time + step.walk_time);
+                else ++trips;
+                stop = step.stop2;
+                time = step.end_time;
+            }
+            assert(stop == dest && time == arrival && trips == journey.trips() && trips <= 5);
+            ++journeys;
+        }
+
+        workspace.begin();
+        auto unset = [](int32_t t) { return t == NO_TIME; };
+        assert(all_of(workspace.previous_labels.begin(), workspace.previous_labels.end(), unset));
+        assert(all_of(workspace.labels.begin(), workspace.labels.end(), unset));
+        assert(all_of(workspace.earliest.begin(), workspace.earliest.end(), unset));
+        assert(workspace.log.empty());
+        for (uint32_t p = 0; p < TT.num_patterns(); ++p) assert(workspace.previous_trip(p) == NO_INDEX);
+    }
+    cout << "Assert passed - " << journeys << " journeys, pruned or not, chain from source to destination\n";
+    cout << "Assert passed - query workspace labels, label log and boarded trips reset between 100 random queries\n";
+
+    // Round by round over every trip: a trip is ridden from the first stop the
+    // previous round reached in time for it, then one footpath is walked from
+    // each stop a trip reached.
+    auto reference_arrival = [](uint32_t source, uint32_t dest, int departure, int K) {
+        vector<int> labels(TT.num_stops(), NO_TIME), best;
+        auto walk = [](vector<int> &labels) {
+            const vector<int> bases = labels;
+            for (uint32_t stop = 0; stop < TT.num_stops(); ++stop) {
+                if (bases[stop] == NO_TIME) continue;
+                for (uint32_t i = TT.transfer_offsets[stop]; i < TT.transfer_offsets[stop + 1]; ++i) {
+                    int &label = labels[TT.transfer_targets[i]];
+                    label = min(label, bases[stop] + TT.transfer_walk_times[i]);
+                }
+            }
+        };
+        labels[source] = departure;
+        walk(labels);
+        best = labels;
+        for (int k = 1; k <= K; ++k) {
+            vector<int> next(TT.num_stops(), NO_TIME);
+            for (uint32_t trip = 0; trip < TT.num_trips(); ++trip) {
+                const uint32_t pattern = TT.trip_patterns[trip];
+                const uint32_t *stops = TT.stops_of(pattern);
+                bool boarded = false;
+                for (uint32_t i = 0; i < TT.pattern_size(pattern); ++i) {
+                    if (boarded) next[stops[i]] = min(next[stops[i]], TT.arrival(trip, i));
+                    boarded = boarded || labels[stops[i]] <= TT.departure(trip, i);
+                }
+            }
+            walk(next);
+            labels = next;
+            for (uint32_t stop = 0; stop < TT.num_stops(); ++stop) best[stop] = min(best[stop], labels[stop]);
+        }
+        return best[dest] == NO_TIME ? -1 : best[dest];
+    };
+    for (int i = 0; i < 20; ++i) {
+        uint32_t source = stop_dist(gen), dest = stop_dist(gen);
+        int departure = day_dist(gen);
+        int arrival = raptor_journey(TT.stop_ids[source], TT.stop_ids[dest], departure, 5).arrival();
+        assert(arrival == reference_arrival(source, dest, departure, 5));
+    }
+    cout << "Assert passed - route scans switching to earlier trips match a scan of every trip for 20 random queries\n";
+
+    for (const RaptorEngine &engine : raptor_engines()) {
+        if (engine.max_rounds == 0) continue;
+        assert(raptor_engine(engine.max_rounds, engine.pruning) == engine.fn);
+        RaptorEngineFn generic = raptor_engine(0, engine.pruning);
+        for (int i = 0; i < 10; ++i) {
+            uint32_t source = stop_dist(gen), dest = stop_dist(gen);
+            int departure = day_dist(gen);
+            Journey specialised = engine.fn(workspace, source, dest, departure, engine.max_rounds);
+            int arrival = specialised.arrival(), legs = specialised.num_legs();
+            Journey journey = generic(workspace, source, dest, departure, engine.max_rounds);
+            assert(journey.arrival() == arrival && int(journey.num_legs()) == legs);
+        }
+    }
+    assert(raptor_engine(9, Pruning::none) == raptor_engine(0, Pruning::none));
+    cout << "Assert passed - engines specialised for K = 1..8 match the generic engine for 10 random queries each\n";
+
+    int profile_journeys = 0;
+    for (int i = 0; i < 10; ++i) {
+        int source = TT.stop_ids[stop_dist(gen)], dest = TT.stop_ids[stop_dist(gen)];
+        for (int windows : { 1, 4 }) {
+            vector<ProfileJourney> profile = raptor_range(source, dest, 8 * 3600, 10 * 3600, 5, windows);
+            for (size_t j = 0; j < profile.size(); ++j) {
+                const ProfileJourney &journey = profile[j];
+                assert(journey.departure >= 8 * 3600 && journey.departure <= 10 * 3600 && journey.trips <= 5);
+                if (j) assert(make_pair(profile[j - 1].departure, profile[j - 1].trips) < make_pair(journey.departure, journey.trips));
+                for (const ProfileJourney &other : profile) {
+                    assert(&other == &journey || other.departure < journey.departure || other.arrival > journey.arrival ||
+                           other.trips > journey.trips);
+                }
+                int arrival = raptor_journey(source, dest, journey.departure, journey.trips).arrival();
+                assert(arrival != -1 && arrival <= journey.arrival);
+            }
+            profile_journeys += profile.size();
+        }
+    }
+    cout << "Assert passed - " << profile_journeys << " profile journeys over 08:00-10:00 in 1 and 4 windows "
+         << "are Pareto optimal and each reachable by a single query\n";
+
+    const uint32_t set_size = 5000;
+    vector<uint32_t> indices(100000);
+    for (uint32_t &i : indices) i = gen() % (gen() % 2 ? 64 : set_size);
+    MarkedSet marked, marked_atomic;
+    marked.resize(set_size);
+    marked_atomic.resize(set_size);
+    for (int pass = 0; pass < 2; ++pass) {
+        vector<uint32_t> first_seen;
+        vector<bool> seen(set_size);
+        for (uint32_t i : indices) {
+            assert(marked.insert(i) == !seen[i]);
+            if (!seen[i]) first_seen.push_back(i);
+            seen[i] = true;
+        }
+        assert(equal(marked.begin(), marked.end(), first_seen.begin(), first_seen.end()));
+
+        uint32_t inserted = 0;
+        #pragma omp parallel for num_threads(4) reduction(+:inserted)
+        for (int j = 0; j < (int)indices.size(); ++j) inserted += marked_atomic.insert_atomic(indices[j]);
+        vector<uint32_t> members(marked_atomic.begin(), marked_atomic.end());
+        sort(members.begin(), members.end());
+        sort(first_seen.begin(), first_seen.end());
+        assert(inserted == first_seen.size() && members == first_seen);
+        for (uint32_t i = 0; i < set_size; ++i) assert(marked.contains(i) == seen[i] && marked_atomic.contains(i) == seen[i]);
+
+        marked.clear();
+        marked_atomic.clear();
+        for (uint32_t i = 0; i < set_size; ++i) assert(!marked.contains(i) && !marked_atomic.contains(i));
+        assert(marked.empty() && marked_atomic.empty());
+    }
+    cout << "Assert passed - marked sets list each index once, in insertion order, and under 4 inserting threads\n";
+
+    // bags against the Pareto set of everything inserted, kept inline and spilled
+    McBag bag;
+    for (int pass = 0; pass < 200; ++pass) {
+        vector<McLabel> labels;
+        bag.clear();
+        for (int i = 0; i < 30; ++i) {
+            McLabel label{ int32_t(gen() % 20), int32_t(gen() % 20), uint32_t(gen() % 3), uint32_t(i) };
+            bool dominated = any_of(labels.begin(), labels.end(), [&](const McLabel &l) { return McLabel::dominates(l, label); });
+            assert(bag.dominates(label) == dominated && bag.insert(label) == !dominated);
+            labels.push_back(label);
+        }
+        vector<uint32_t> pareto, kept;
+        for (const McLabel &label : labels) {
+            bool dominated = any_of(labels.begin(), labels.end(), [&](const McLabel &l) {
+                return McLabel::dominates(l, label) && (!McLabel::dominates(label, l) || l.entry < label.entry);
+            });
+            if (!dominated) pareto.push_back(label.entry);
+        }
+        for (const McLabel &label : bag) kept.push_back(label.entry);
+        sort(kept.begin(), kept.end());
+        assert(kept == pareto);
+    }
+    cout << "Assert passed - label bags keep the Pareto set of 30 random labels, 200 times\n";
+
+    int mc_journeys = 0;
+    for (int i = 0; i < 30; ++i) {
+        int source = TT.stop_ids[stop_dist(gen)], dest = TT.stop_ids[stop_dist(gen)];
+        int departure = day_dist(gen);
+        vector<McJourney> journeys = mc_raptor(source, dest, departure, 5);
+        for (const McJourney &journey : journeys) {
+            uint32_t stop = stop_index(source);
+            int time = departure, trips = 0, walk_time = 0;
+            for (const Leg &leg : journey.legs) {
+                assert(leg.from_stop == stop && leg.start_time >= time && leg.end_time >= leg.start_time);
+                if (leg.type == LegType::trip) ++trips;
+                else walk_time += leg.end_time - leg.start_time;
+                stop = leg.to_stop;
+                time = leg.end_time;
+            }
+            assert(stop == stop_index(dest) && time == journey.arrival && trips == journey.trips && trips <= 5 &&
+                   walk_time == journey.walk_time);
+            for (const McJourney &other : journeys) {
+                assert(&other == &journey || other.arrival > journey.arrival || other.trips > journey.trips ||
+                       other.walk_time > journey.walk_time);
+            }
+        }
+        // McRAPTOR keeps every label pruned RAPTOR keeps, and more
+        int arrival = raptor_journey(source, dest, departure, 5, Pruning::full).arrival();
+        if (arrival != -1) assert(!journeys.empty() && journeys[0].arrival <= arrival);
+        mc_journeys += journeys.size();
+    }
+    cout << "Assert passed - " << mc_journeys << " McRAPTOR journeys for 30 random queries chain from source to "
+         << "destination, are Pareto optimal and arrive no later than pruned RAPTOR's\n";
+
     cout << "ALL ASSERTIONS PASSED\n";
 }
 
@@ -160,6 +613,13 @@ int main(int argc, char* argv[]) {
     string dest = "";
     string departure = "";
     string dataset = "gtfs-data";
+    string benchmark = "";
+    string snapshot = "";
+    string write_snapshot_path = "";
+    bool verify_snapshot = false;
+    int closure_budget = 0;
+    Pruning pruning = Pruning::none;
+    bool multi_criteria = false;
     int argIndex = 1;
     int iterations = 500;
     
@@ -182,6 +642,20 @@ int main(int argc, char* argv[]) {
             dest = argv[++argIndex];
         } else if (arg == "--departure" && argIndex + 1 < argc) {
             departure = argv[++argIndex];
+        } else if (arg == "--bench" && argIndex + 1 < argc) {
+            benchmark = argv[++argIndex];
+        } else if (arg == "--snapshot" && argIndex + 1 < argc) {
+            snapshot = argv[++argIndex];
+        } else if (arg == "--write-snapshot" && argIndex + 1 < argc) {
+            write_snapshot_path = argv[++argIndex];
+        } else if (arg == "--verify-snapshot") {
+            verify_snapshot = true;
+        } else if (arg == "--close-footpaths" && argIndex + 1 < argc) {
+            closure_budget = stoi(argv[++argIndex]);
+        } else if (arg == "--prune") {
+            pruning = Pruning::full;
+        } else if (arg == "--mc") {
+            multi_criteria = true;
         }
         ++argIndex;
     }
@@ -193,27 +667,79 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    if (!benchmark.empty() && run_load_benchmark(benchmark, dataset)) {
+        return 0;
+    }
+
     auto build_time_start = chrono::high_resolution_clock::now();
-    build_all(dataset);
+    if (snapshot.empty()) {
+        build_all(dataset, closure_budget);
+    } else if (!load_snapshot(snapshot, verify_snapshot)) {
+        return 1;
+    }
     auto build_time_end = chrono::high_resolution_clock::now();
 
     cout << chrono::duration<double>(build_time_end - build_time_start).count() << endl;
 
+    if (!write_snapshot_path.empty() && !write_snapshot(write_snapshot_path)) {
+        return 1;
+    }
+
+    // the tests and benchmarks check TT against the maps built the original way
+    if (snapshot.empty() && (run_tests || !benchmark.empty())) {
+        build_legacy_maps(dataset);
+    }
+
     if (run_tests) {
-        conduct_unit_tests(dataset);
+        if (snapshot.empty()) {
+            conduct_unit_tests(dataset);
+        } else {
+            // the tests compare against the GTFS tables, which a snapshot does not carry
+            cout << "Skipping unit tests: they need the GTFS feed, not a snapshot" << endl;
+        }
     }
 
-    vector<int> stop_ids;
-    stop_ids.reserve(StopCoords.size());
-    for (const auto& stop_coords : StopCoords) {
-        stop_ids.push_back(stop_coords.first);
+    if (!benchmark.empty()) {
+        if (!run_benchmark(benchmark)) {
+            cerr << "Unknown benchmark: " << benchmark << endl;
+            return 1;
+        }
+        return 0;
     }
 
+    vector<int> stop_ids(TT.stop_ids.begin(), TT.stop_ids.end());
+
     std::random_device rd; 
     std::mt19937 gen(rd()); 
     std::uniform_int_distribution<> distrib(0, stop_ids.size() - 1); // random source/dest stop
     std::uniform_int_distribution<int> dep_dist(36000, 64800); // random departure time between 10AM and 6PM
 
+    auto write_steps = [&](const vector<PathStep> &path) {
+        for (size_t i = 0; i < path.size(); ++i) {
+            const auto& transfer = path[i];
+            fout << i + 1 << " - ";
+            if (transfer.type == LegType::walk) {
+                fout << "WALK:" << '\n';
+                fout << "Walk from stop " << transfer.stop1
+                    << " to stop " << transfer.stop2 << '\n';
+                fout << "Start: " << seconds_to_time(transfer.start_time)
+                    << ", End: " << seconds_to_time(transfer.end_time) << '\n';
+                fout << "Walking time: " << transfer.walk_time / 60
+                    << " min " << transfer.walk_time % 60 << " s" << '\n';
+            } else {
+                fout << "BUS/TRAIN:" << '\n';
+                fout << "Board stop " << transfer.stop1
+                    << "; Get down at stop " << transfer.stop2 << '\n';
+                fout << "Start: " << seconds_to_time(transfer.start_time)
+                    << ", End: " << seconds_to_time(transfer.end_time) << '\n';
+                int transit_time = transfer.end_time - transfer.start_time;
+                fout << "Transit time: " << transit_time / 60
+                    << " min " << transit_time % 60 << " s" << '\n';
+            }
+            fout << '\n';
+        }
+    };
+
     auto raptor_time_start = chrono::high_resolution_clock::now();
     for (int iter = 0; iter < iterations; ++iter) {
         int dep_time = departure.empty() ? dep_dist(gen) : stoi(departure);
@@ -225,9 +751,30 @@ int main(int argc, char* argv[]) {
             dest_stop = stop_ids[distrib(gen)];
         }
 
-        auto [arr_time, path] = raptor(source_stop, dest_stop, dep_time, K);
+        if (multi_criteria) {
+            vector<McJourney> journeys = mc_raptor(source_stop, dest_stop, dep_time, K);
+            fout << "Source stop: " << source_stop << '\n';
+            fout << "Dest stop: " << dest_stop << '\n';
+            fout << "Departure time: " << seconds_to_time(dep_time) << '\n';
+            if (journeys.empty()) fout << "No path found.\n";
+            else fout << "Pareto journeys: " << journeys.size() << '\n';
+            fout << '\n';
+            for (size_t j = 0; j < journeys.size(); ++j) {
+                fout << "Journey " << j + 1 << ": arrival " << seconds_to_time(journeys[j].arrival) << ", "
+                     << journeys[j].trips << " trips, walking " << journeys[j].walk_time / 60 << " min "
+                     << journeys[j].walk_time % 60 << " s" << '\n';
+                fout << '\n';
+                write_steps(path_of(journeys[j].legs));
+            }
+            fout << "============================================" << '\n';
+            fout << '\n';
+            continue;
+        }
+
+        Journey journey = raptor_journey(source_stop, dest_stop, dep_time, K, pruning);
+        int arr_time = journey.arrival();
 
-        if (arr_time == -1) {
+        if (!journey.found()) {
             fout << "Source stop: " << source_stop << '\n';
             fout << "Dest stop: " << dest_stop << '\n';
             fout << "Departure time: " << seconds_to_time(dep_time) << '\n';
@@ -241,32 +788,11 @@ int main(int argc, char* argv[]) {
         fout << "Dest stop: " << dest_stop << '\n';
         fout << "Departure time: " << seconds_to_time(dep_time) << '\n';
         fout << "Arrival time: " << seconds_to_time(arr_time) << '\n';
+        vector<PathStep> path = journey.path();
         fout << "Transfers: " << path.size() - 1 << '\n';
         fout << '\n';
 
-        for (size_t i = 0; i < path.size(); ++i) {
-            const auto& transfer = path[i];
-            fout << i + 1 << " - ";
-            if (transfer.type == "walk") {
-                fout << "WALK:" << '\n';
-                fout << "Walk from stop " << transfer.stop1
-                    << " to stop " << transfer.stop2 << '\n';
-                fout << "Start: " << seconds_to_time(transfer.start_time)
-                    << ", End: " << seconds_to_time(transfer.end_time) << '\n';
-                fout << "Walking time: " << transfer.walk_time / 60
-                    << " min " << transfer.walk_time % 60 << " s" << '\n';
-            } else {
-                fout << "BUS/TRAIN:" << '\n';
-                fout << "Board stop " << transfer.stop1
-                    << "; Get down at stop " << transfer.stop2 << '\n';
-                fout << "Start: " << seconds_to_time(transfer.start_time)
-                    << ", End: " << seconds_to_time(transfer.end_time) << '\n';
-                int transit_time = transfer.end_time - transfer.start_time;
-                fout << "Transit time: " << transit_time / 60
-                    << " min " << transit_time % 60 << " s" << '\n';
-            }
-            fout << '\n';
-        }
+        write_steps(path);
         fout << "============================================" << '\n';
         fout << '\n';
     }
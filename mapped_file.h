@@ -0,0 +1,69 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdint>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only, private memory mapping of a whole file.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+        if (len > 0) munmap(const_cast<char *>(ptr), len);
+    }
+
+    // Maps `path`; false, with errno set, if it cannot be opened or mapped.
+    bool open(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+
+        len = st.st_size;
+        if (len > 0) {
+            void *addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                len = 0;
+                ::close(fd);
+                return false;
+            }
+            ptr = static_cast<const char *>(addr);
+        }
+        ::close(fd);
+        return true;
+    }
+
+    // Hint that the mapping will be read front to back once, for more read-ahead.
+    void advise_sequential() const {
+        if (len > 0) madvise(const_cast<char *>(ptr), len, MADV_SEQUENTIAL);
+    }
+
+    // Drops the pages wholly inside [from, to) from this process's resident set.
+    // They stay in the page cache and are faulted back in if read again.
+    void release(const char *from, const char *to) const {
+        const uintptr_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t begin = (reinterpret_cast<uintptr_t>(from) + page - 1) / page * page;
+        uintptr_t end = reinterpret_cast<uintptr_t>(to) / page * page;
+        if (begin < end) madvise(reinterpret_cast<void *>(begin), end - begin, MADV_DONTNEED);
+    }
+
+    const char *data() const { return ptr; }
+    size_t size() const { return len; }
+
+private:
+    const char *ptr = "";
+    size_t len = 0;
+};
+
+#endif
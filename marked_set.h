@@ -0,0 +1,59 @@
+#ifndef MARKED_SET_H
+#define MARKED_SET_H
+
+#include <cstdint>
+#include <vector>
+
+// Set of dense indices [0, n), such as the stops marked in a RAPTOR round: a
+// bitset answers membership and a list of the members, in the order they were
+// inserted, serves iteration. Clearing costs O(members), not O(n).
+class MarkedSet {
+public:
+    // Empties the set and sizes it for indices [0, n).
+    void resize(uint32_t n) {
+        words.assign((n + 63) / 64, 0);
+        members.resize(n);
+        count = 0;
+    }
+
+    uint32_t capacity() const { return members.size(); }
+    uint32_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    uint32_t operator[](uint32_t i) const { return members[i]; }
+    const uint32_t *begin() const { return members.data(); }
+    const uint32_t *end() const { return members.data() + count; }
+
+    bool contains(uint32_t i) const { return words[i / 64] >> (i % 64) & 1; }
+
+    // Adds i; false if it was already in.
+    bool insert(uint32_t i) {
+        const uint64_t bit = uint64_t(1) << (i % 64);
+        if (words[i / 64] & bit) return false;
+        words[i / 64] |= bit;
+        members[count++] = i;
+        return true;
+    }
+
+    // insert() for threads adding to the set at once: the thread whose atomic
+    // test-and-set flips the bit appends i to a slot it claims atomically. Reads
+    // of the set must wait until every thread is done, e.g. after an OpenMP barrier.
+    bool insert_atomic(uint32_t i) {
+        const uint64_t bit = uint64_t(1) << (i % 64);
+        if (__atomic_load_n(&words[i / 64], __ATOMIC_RELAXED) & bit) return false;
+        if (__atomic_fetch_or(&words[i / 64], bit, __ATOMIC_RELAXED) & bit) return false;
+        members[__atomic_fetch_add(&count, 1, __ATOMIC_RELAXED)] = i;
+        return true;
+    }
+
+    void clear() {
+        for (uint32_t j = 0; j < count; ++j) words[members[j] / 64] = 0;
+        count = 0;
+    }
+
+private:
+    std::vector<uint64_t> words;
+    std::vector<uint32_t> members; // [0, count) listed, room for every index
+    uint32_t count = 0;
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include "mc_raptor.h"
+#include "route_scan.h"
+
+using namespace std;
+
+void McWorkspace::begin() {
+    if (bags.size() != TT.num_stops()) {
+        previous_bags.assign(TT.num_stops(), McBag());
+        bags.assign(TT.num_stops(), McBag());
+        best_bags.assign(TT.num_stops(), McBag());
+        previous_stops.resize(TT.num_stops());
+        stops.resize(TT.num_stops());
+        marked_stops.resize(TT.num_stops());
+        walk_marked_stops.resize(TT.num_stops());
+    } else {
+        for (const LabelEntry &entry : log)
+            best_bags[entry.stop].clear();
+        for (uint32_t stop : previous_stops) previous_bags[stop].clear();
+        for (uint32_t stop : stops) bags[stop].clear();
+    }
+    log.clear();
+    previous_stops.clear();
+    stops.clear();
+    marked_stops.clear();
+    walk_marked_stops.clear();
+
+    if (Q.capacity() != TT.num_patterns()) {
+        Q.resize(TT.num_patterns());
+        Q_positions.assign(TT.num_patterns(), NO_INDEX);
+    }
+}
+
+static McWorkspace &thread_mc_workspace() {
+    static thread_local McWorkspace workspace;
+    return workspace;
+}
+
+vector<McJourney> mc_raptor(int source_stop_id, int dest_stop_id, int departure_time, int K) {
+    return mc_raptor(thread_mc_workspace(), source_stop_id, dest_stop_id, departure_time, K);
+}
+
+vector<McJourney> mc_raptor(McWorkspace &ws, int source_stop_id, int dest_stop_id, int departure_time, int K) {
+    const uint32_t source_stop = stop_index(source_stop_id);
+    const uint32_t dest_stop = stop_index(dest_stop_id);
+    if (source_stop == NO_INDEX || dest_stop == NO_INDEX) {
+        return {};
+    }
+    ws.begin();
+    vector<LabelEntry> &log = ws.log;
+    const McBag &dest_bag = ws.best_bags[dest_stop];
+
+    // Labels `stop` with `label` in the current round unless the stop's or the
+    // destination's best bag dominates it (local and target pruning), which
+    // every journey on from it would be too. The caller fills in the log entry.
+    auto add_label = [&](uint32_t stop, McLabel label, uint32_t parent) -> LabelEntry* {
+        if (dest_bag.dominates(label)) return nullptr;
+        label.entry = log.size();
+        if (!ws.best_bags[stop].insert(label)) return nullptr;
+        ws.bags[stop].insert(label);
+        ws.stops.insert(stop);
+        log.push_back(LabelEntry{ stop, label.arrival, parent, NO_INDEX, { 0 } });
+        return &log.back();
+    };
+
+    // footpaths from the stop of `label`, which the current round set
+    auto walk_from = [&](uint32_t stop, const McLabel &label, MarkedSet &marked) {
+        for (uint32_t i = TT.transfer_offsets[stop]; i < TT.transfer_offsets[stop + 1]; ++i) {
+            const int32_t walk_time = TT.transfer_walk_times[i];
+            const uint32_t target = TT.transfer_targets[i];
+            McLabel walked{ label.arrival + walk_time, label.walk + walk_time, label.trips, 0 };
+            if (LabelEntry *entry = add_label(target, walked, label.entry)) {
+                entry->walk_time = walk_time;
+                marked.insert(target);
+            }
+        }
+    };
+
+    MarkedSet &marked_stops = ws.marked_stops;
+    add_label(source_stop, McLabel{ departure_time, 0, 0, 0 }, NO_INDEX);
+    marked_stops.insert(source_stop);
+    walk_from(source_stop, *ws.bags[source_stop].begin(), marked_stops);
+
+    for (uint32_t k = 1; k <= uint32_t(K) && !marked_stops.empty(); ++k) {
+        // round k-1's bags become the previous round's, and round k starts
+        // from the bags round k-2 used, emptied
+        swap(ws.previous_bags, ws.bags);
+        swap(ws.previous_stops, ws.stops);
+        for (uint32_t stop : ws.stops) ws.bags[stop].clear();
+        ws.stops.clear();
+
+        MarkedSet &Q = ws.Q;
+        uint32_t *Q_positions = ws.Q_positions.data();
+        collect_patterns(marked_stops, Q, Q_positions, false, [](uint32_t) { return false; });
+        marked_stops.clear();
+
+        // At each stop of the pattern, the trips of the route bag set labels
+        // there, then the stop's labels of round k-1 join the bag on the
+        // earliest trip each can catch.
+        RouteBag &route_bag = ws.route_bag;
+        for (uint32_t pattern : Q) {
+            const uint32_t first_pos = Q_positions[pattern];
+            Q_positions[pattern] = NO_INDEX;
+            const uint32_t *pattern_stops = TT.stops_of(pattern);
+            const uint32_t pattern_len = TT.pattern_size(pattern);
+
+            route_bag.clear();
+            for (uint32_t idx = first_pos; idx < pattern_len; ++idx) {
+                const uint32_t stop = pattern_stops[idx];
+
+                for (const RouteLabel &ride : route_bag) {
+                    McLabel label{ TT.arrival(ride.trip, idx), ride.walk, k, 0 };
+                    if (LabelEntry *entry = add_label(stop, label, ride.parent)) {
+                        entry->trip = ride.trip;
+                        entry->board_pos = ride.board_pos;
+                        marked_stops.insert(stop);
+                    }
+                }
+
+                for (const McLabel &label : ws.previous_bags[stop]) {
+                    uint32_t trip = earliest_trip(pattern, idx, label.arrival);
+                    if (trip != NO_INDEX) route_bag.insert(RouteLabel{ trip, label.walk, label.entry, idx });
+                }
+            }
+        }
+        Q.clear();
+
+        // walks start from the labels the trips just set, as in raptor_journey()
+        vector<pair<uint32_t,McLabel>> &trip_labels = ws.trip_labels;
+        trip_labels.clear();
+        for (uint32_t stop : marked_stops) {
+            for (const McLabel &label : ws.bags[stop]) trip_labels.push_back({ stop, label });
+        }
+
+        MarkedSet &walk_marked = ws.walk_marked_stops;
+        walk_marked.clear();
+        for (const auto &[stop, label] : trip_labels)
+            walk_from(stop, label, walk_marked);
+        for (uint32_t stop : walk_marked)
+            marked_stops.insert(stop);
+    }
+
+    vector<McJourney> journeys;
+    for (const McLabel &label : dest_bag) {
+        McJourney journey{ label.arrival, int(label.trips), label.walk, {} };
+        trace_legs(log, label.entry, [&](const Leg &leg) { journey.legs.push_back(leg); });
+        reverse(journey.legs.begin(), journey.legs.end());
+        journeys.push_back(move(journey));
+    }
+    sort(journeys.begin(), journeys.end(), [](const McJourney &a, const McJourney &b) {
+        return a.arrival != b.arrival ? a.arrival < b.arrival : a.trips < b.trips;
+    });
+    return journeys;
+}
@@ -0,0 +1,86 @@
+#ifndef MC_RAPTOR_H
+#define MC_RAPTOR_H
+
+#include <cstdint>
+#include <vector>
+#include "raptor.h"
+#include "label_bag.h"
+
+// A McRAPTOR label at a stop: reached at `arrival` after riding `trips` trips
+// and walking `walk` seconds in all; `entry` is its index in the label log.
+struct McLabel {
+    int32_t arrival;
+    int32_t walk;
+    uint32_t trips;
+    uint32_t entry;
+
+    static bool dominates(const McLabel &a, const McLabel &b) {
+        return (a.arrival <= b.arrival) & (a.walk <= b.walk) & (a.trips <= b.trips);
+    }
+};
+
+// A label of a route bag: riding `trip`, boarded at position board_pos of its
+// pattern from the label logged as `parent`. The labels of a route bag share
+// their trip count and the trips of a pattern do not overtake each other, so
+// an earlier trip arrives no later at every stop still ahead.
+struct RouteLabel {
+    uint32_t trip;
+    int32_t walk;
+    uint32_t parent;
+    uint32_t board_pos;
+
+    static bool dominates(const RouteLabel &a, const RouteLabel &b) {
+        return (a.trip <= b.trip) & (a.walk <= b.walk);
+    }
+};
+
+// A stop's bag: 3 labels inline with the count and the spill pointer fill a
+// cache line, and the bags are aligned to one, so that reading the labels of
+// most stops touches a single line.
+struct alignas(64) McBag : LabelBag<McLabel, 3> {};
+static_assert(sizeof(McBag) == 64, "a stop's bag is one cache line");
+
+typedef LabelBag<RouteLabel, 4> RouteBag;
+
+// Scratch memory of mc_raptor(), kept from one query to the next like
+// QueryWorkspace: the bags of rounds k-1 and k, the best bag of every stop
+// over all rounds, and a log of every label set, which journeys are traced
+// back through. begin() empties only the bags the last query filled.
+struct McWorkspace {
+    // Readies the workspace for a query on TT.
+    void begin();
+
+    vector<McBag> previous_bags, bags; // [stop], labels of rounds k-1 and k
+    vector<McBag> best_bags;           // [stop], labels over all rounds
+    MarkedSet previous_stops, stops;   // stops whose bag of round k-1, k has labels
+    vector<LabelEntry> log;            // labels set, in order
+
+    // per-round scratch, cleared but not freed
+    MarkedSet marked_stops, walk_marked_stops;
+    MarkedSet Q;                  // patterns to scan in a round
+    vector<uint32_t> Q_positions; // [pattern], where to scan from; NO_INDEX when not in Q
+    RouteBag route_bag;
+    vector<pair<uint32_t,McLabel>> trip_labels; // (stop, label)
+};
+
+// A Pareto optimal journey of mc_raptor(), with its legs in travel order.
+struct McJourney {
+    int arrival;
+    int trips;
+    int walk_time; // seconds walked over all footpaths
+    vector<Leg> legs;
+};
+
+// McRAPTOR: every journey from source_stop at departure_time to dest_stop
+// with at most K trips that no other beats or ties in arrival, trips and
+// walking time, ordered by arrival. Round k holds at each stop a bag of the
+// labels of k trips that no label of the stop over all rounds, nor of the
+// destination, dominates. A route is scanned with a bag of the trips it can be
+// ridden on, each stop's bag of round k-1 merged into it. Runs on the
+// compiled TT, as raptor_journey() does, in `workspace` or in one kept per
+// thread. The earliest arrival is never later than raptor_journey()'s with
+// Pruning::full, and is raptor_journey()'s when the footpaths are closed.
+vector<McJourney> mc_raptor(McWorkspace &workspace, int source_stop, int dest_stop, int departure_time, int K);
+vector<McJourney> mc_raptor(int source_stop, int dest_stop, int departure_time, int K);
+
+#endif
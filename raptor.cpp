@@ -1,268 +1,306 @@
 #include "raptor.h"
+#include "trip_search.h"
+#include "route_scan.h"
 #include <iostream>
-#include <map>
 #include <set>
+#include <utility>
 #include <cstdio>
 #include <omp.h>
 
 using namespace std;
 
-struct TakenStep {
-    int prev_stop;
-    int prev_round;
-    string mode;
-    int walk_time;
-};
+uint32_t earliest_trip(uint32_t pattern, uint32_t stop_pos, int board_time) {
+    const int32_t *departures = TT.stop_departures(pattern, stop_pos);
+    const uint32_t num_trips = TT.pattern_trip_count(pattern);
 
-string earliest_trip(const string& route_id, int board_stop, int board_time) {
-    string best_trip = "";
-    int best_dep = numeric_limits<int>::max();
+    uint32_t i = first_at_least(departures, num_trips, board_time);
+    return i == num_trips ? NO_INDEX : TT.pattern_trip_offsets[pattern] + i;
+}
 
-    omp_set_num_threads(4);
+uint32_t earliest_trip(uint32_t pattern, uint32_t stop_pos, int board_time, uint32_t hint) {
+    if (hint == NO_INDEX) {
+        return earliest_trip(pattern, stop_pos, board_time);
+    }
 
-    #pragma omp parallel
-    {
-        string local_best_trip = "";
-        int local_best_dep = numeric_limits<int>::max();
-
-        #pragma omp for schedule(dynamic) nowait
-        for (size_t i = 0; i < RouteTrips[route_id].size(); i++) {
-            const string &trip_id = RouteTrips[route_id][i];
-            const auto &stops = Trips[trip_id].stops;
-            if (stops.count(board_stop) == 0) {
-                continue;
-            }
-            int dep = stops.at(board_stop).second;
-            if (dep >= board_time && dep < local_best_dep) {
-                local_best_dep = dep;
-                local_best_trip = trip_id;
-            }
+    const int32_t *departures = TT.stop_departures(pattern, stop_pos);
+    const uint32_t num_trips = TT.pattern_trip_count(pattern);
+    const uint32_t h = hint - TT.pattern_trip_offsets[pattern];
+
+    // gallop away from the hint until the answer is bracketed, then binary search the bracket
+    uint32_t lo, hi;
+    uint32_t bound = 1;
+    if (departures[h] >= board_time) {
+        while (bound <= h && departures[h - bound] >= board_time) {
+            bound *= 2;
+        }
+        lo = bound > h ? 0 : h - bound + 1;
+        hi = h - bound / 2 + 1;
+    } else {
+        while (h + bound < num_trips && departures[h + bound] < board_time) {
+            bound *= 2;
         }
+        lo = h + bound / 2 + 1;
+        hi = min(h + bound + 1, num_trips);
+    }
 
-        #pragma omp critical
-        {
-            if (!local_best_trip.empty() && local_best_dep < best_dep) {
-                best_dep = local_best_dep;
-                best_trip = local_best_trip;
-            }
+    uint32_t i = lo + first_at_least(departures + lo, hi - lo, board_time);
+    return i == num_trips ? NO_INDEX : TT.pattern_trip_offsets[pattern] + i;
+}
+
+void QueryWorkspace::begin() {
+    if (labels.size() != TT.num_stops()) {
+        previous_labels.assign(TT.num_stops(), NO_TIME);
+        labels.assign(TT.num_stops(), NO_TIME);
+        previous_entries.assign(TT.num_stops(), NO_INDEX);
+        entries.assign(TT.num_stops(), NO_INDEX);
+        earliest.assign(TT.num_stops(), NO_TIME);
+        marked_stops.resize(TT.num_stops());
+        walk_marked_stops.resize(TT.num_stops());
+    } else {
+        for (const LabelEntry &entry : log) {
+            previous_labels[entry.stop] = NO_TIME;
+            labels[entry.stop] = NO_TIME;
+            earliest[entry.stop] = NO_TIME;
         }
     }
-    return best_trip;
+    log.clear();
+    round_starts.clear();
+    marked_stops.clear();
+    walk_marked_stops.clear();
+
+    if (pattern_epochs.size() != TT.num_patterns()) {
+        previous_trips.assign(TT.num_patterns(), NO_INDEX);
+        pattern_epochs.assign(TT.num_patterns(), 0);
+        Q.resize(TT.num_patterns());
+        Q_positions.assign(TT.num_patterns(), NO_INDEX);
+    }
+    // stamps start over when the epoch wraps around, so that no stale one matches
+    if (++epoch == 0) {
+        fill(pattern_epochs.begin(), pattern_epochs.end(), 0);
+        epoch = 1;
+    }
 }
 
+static QueryWorkspace &thread_workspace() {
+    static thread_local QueryWorkspace workspace;
+    return workspace;
+}
 
-pair<int, vector<PathStep>> raptor(int source_stop, int dest_stop, int departure_time, int K) {
-    const int total_stops = StopCoords.size();
+Journey raptor_journey(int source_stop_id, int dest_stop_id, int departure_time, int K, Pruning pruning) {
+    return raptor_journey(thread_workspace(), source_stop_id, dest_stop_id, departure_time, K, pruning);
+}
 
-    unordered_map<int, vector<int>> stop_arrival_times;
-    unordered_map<int, int> earliest_stop_arrival_times;
+pair<int, vector<PathStep>> raptor(QueryWorkspace &ws, int source_stop_id, int dest_stop_id, int departure_time, int K,
+                                   Pruning pruning) {
+    Journey journey = raptor_journey(ws, source_stop_id, dest_stop_id, departure_time, K, pruning);
+    return { journey.arrival(), journey.path() };
+}
 
-    stop_arrival_times.reserve(total_stops);
-    earliest_stop_arrival_times.reserve(total_stops);
+pair<int, vector<PathStep>> raptor(int source_stop_id, int dest_stop_id, int departure_time, int K, Pruning pruning) {
+    return raptor(thread_workspace(), source_stop_id, dest_stop_id, departure_time, K, pruning);
+}
 
-    for (const auto& kv : StopCoords) {
-        int stop = kv.first;
-        stop_arrival_times[stop] = vector<int>(K + 1, numeric_limits<int>::max());
-        earliest_stop_arrival_times[stop] = numeric_limits<int>::max();
+Journey raptor_journey(QueryWorkspace &ws, int source_stop_id, int dest_stop_id, int departure_time, int K,
+                       Pruning pruning) {
+    const uint32_t source_stop = stop_index(source_stop_id);
+    const uint32_t dest_stop = stop_index(dest_stop_id);
+    if (source_stop == NO_INDEX || dest_stop == NO_INDEX) {
+        return Journey();
     }
+    return raptor_engine(K, pruning)(ws, source_stop, dest_stop, departure_time, K);
+}
 
-    stop_arrival_times[source_stop][0] = departure_time;
-    earliest_stop_arrival_times[source_stop] = departure_time;
-
-    map<pair<int,int>, TakenStep> route_taken;
-
-    unordered_set<int> marked_stops = { source_stop };
+// The search, for at most MaxRounds rounds when MaxRounds is set and K
+// otherwise. With both fixed at compile time the round loop has a constant
+// bound and the pruning tests in the scans fold away.
+template <int MaxRounds, bool prune>
+static Journey search(QueryWorkspace &ws, uint32_t source_stop, uint32_t dest_stop, int departure_time, int K) {
+    const int rounds = MaxRounds > 0 ? MaxRounds : K;
+    ws.begin();
+
+    vector<int32_t> &earliest_stop_arrival_times = ws.earliest;
+    vector<LabelEntry> &log = ws.log;
+    uint32_t dest_entry = NO_INDEX;
+    int dest_round = -1;
+
+    // Labels `stop` with `time` in round k, reached from the label logged as
+    // `parent`; the caller fills in how.
+    auto set_label = [&](uint32_t stop, int32_t time, int k, uint32_t parent) -> LabelEntry& {
+        ws.labels[stop] = time;
+        ws.entries[stop] = log.size();
+        if (time < earliest_stop_arrival_times[stop]) {
+            earliest_stop_arrival_times[stop] = time;
+            if (stop == dest_stop) {
+                dest_entry = log.size();
+                dest_round = k;
+            }
+        }
+        log.push_back(LabelEntry{ stop, time, parent, NO_INDEX, { 0 } });
+        return log.back();
+    };
+
+    ws.round_starts.push_back(0);
+    set_label(source_stop, departure_time, 0, NO_INDEX);
+
+    // Footpaths from `stop`, walked from its round k label `base` (logged as
+    // `base_entry`), label the stops they improve in round k; none reaching
+    // past the destination's best arrival can lead to an earlier one. Pruned,
+    // a walk must also beat the target's earliest arrival over all rounds, not
+    // just its round k label.
+    auto walk_from = [&](uint32_t stop, int k, int base, uint32_t base_entry, MarkedSet &marked) {
+        const int32_t *bounds = prune ? earliest_stop_arrival_times.data() : ws.labels.data();
+        walk_footpaths(stop, base, earliest_stop_arrival_times[dest_stop], bounds, 1, ws.improved,
+                       [&](uint32_t walkable_stop, int walk_time) {
+            set_label(walkable_stop, base + walk_time, k, base_entry).walk_time = walk_time;
+            marked.insert(walkable_stop);
+        });
+    };
+
+    MarkedSet &marked_stops = ws.marked_stops;
+    marked_stops.insert(source_stop);
+    walk_from(source_stop, 0, departure_time, 0, marked_stops);
 
     omp_set_num_threads(4);
 
-    for (int k = 1; k < K+1; ++k) {
-        unordered_map<string,int> Q;
-
-        if (marked_stops.size() <= 200) {
-            for (int marked_stop : marked_stops) {
-                for (const string& route_id : StopRoutes[marked_stop]) {
-                    const auto& stops = RouteStops[route_id];
-                    auto marked_stop_it = std::find(stops.begin(), stops.end(), marked_stop);
-
-                    if (marked_stop_it == stops.end())
-                        continue;
-
-                    int marked_stop_idx = static_cast<int>(marked_stop_it - stops.begin());
-
-                    if (!Q.count(route_id) || marked_stop_idx < Q[route_id]) {
-                        Q[route_id] = marked_stop_idx;
-                    }
-                }
-            }
-        } else {
-            vector<int> marked_stops_vec(marked_stops.begin(), marked_stops.end());
-
-            #pragma omp parallel
-            {
-                unordered_map<string,int> local_Q;
-
-                #pragma omp for schedule(dynamic)
-                for (int i = 0; i < (int)marked_stops_vec.size(); i++) {
-                    int marked_stop = marked_stops_vec[i];
-
-                    for (const string& route_id : StopRoutes[marked_stop]) {
-                        const auto& stops = RouteStops[route_id];
-                        auto marked_stop_it = std::find(stops.begin(), stops.end(), marked_stop);
-
-                        if (marked_stop_it == stops.end())
-                            continue;
-
-                        int marked_stop_idx = static_cast<int>(marked_stop_it - stops.begin());
-
-                        if (!local_Q.count(route_id) || marked_stop_idx < local_Q[route_id]) {
-                            local_Q[route_id] = marked_stop_idx;
-                        }
-                    }
-                }
-
-                #pragma omp critical
-                {
-                    for (const auto& local_Q_routestop : local_Q) {
-                        const string& route_id = local_Q_routestop.first;
-                        int marked_stop_idx = local_Q_routestop.second;
-
-                        if (!Q.count(route_id) || marked_stop_idx < Q[route_id]) {
-                            Q[route_id] = marked_stop_idx;
-                        }
-                    }
-                }
-            }
+    for (int k = 1; k <= rounds; ++k) {
+        // round k-1's labels become the previous round's, and round k starts
+        // from the array round k-2 used, cleared through the log
+        swap(ws.previous_labels, ws.labels);
+        swap(ws.previous_entries, ws.entries);
+        if (k >= 2) {
+            for (uint32_t i = ws.round_starts[k - 2]; i < ws.round_starts[k - 1]; ++i)
+                ws.labels[log[i].stop] = NO_TIME;
         }
-
+        ws.round_starts.push_back(log.size());
+        const int32_t *previous_labels = ws.previous_labels.data();
+        const uint32_t *previous_entries = ws.previous_entries.data();
+        const int32_t *labels = ws.labels.data();
+
+        // pruned, a stop reached no earlier than the destination is not boarded from
+        MarkedSet &Q = ws.Q;
+        uint32_t *Q_positions = ws.Q_positions.data();
+        collect_patterns(marked_stops, Q, Q_positions, true, [&](uint32_t stop) {
+            return prune && previous_labels[stop] >= earliest_stop_arrival_times[dest_stop];
+        });
         marked_stops.clear();
 
-        for (const auto &route_stop : Q) {
-            const string &route_id = route_stop.first;
-            int stop_id = route_stop.second;
-
-            if (!RouteStops.count(route_id)) continue;
-            const auto &route_stops = RouteStops[route_id];
-
-            int boarding_stop = route_stops[stop_id];
-            int boarding_time = stop_arrival_times[boarding_stop][k - 1];
-            if (boarding_time == numeric_limits<int>::max()) 
-                continue;
-
-            string current_trip = earliest_trip(route_id, boarding_stop, boarding_time);
-            if (current_trip.empty()) continue;
-
-            const auto &trip_stops = Trips[current_trip].stops;
-            int curr_trip_dep_time = trip_stops.at(boarding_stop).second;
-
-            for (int idx = stop_id; idx < (int)route_stops.size(); idx++) {
-                int next_stop = route_stops[idx];
-                if (!trip_stops.count(next_stop)) continue;
-
-                int curr_trip_arr_time = trip_stops.at(next_stop).first;
-                if (curr_trip_arr_time < curr_trip_dep_time) continue;
-
-                if (curr_trip_arr_time < stop_arrival_times[next_stop][k]) {
-                    stop_arrival_times[next_stop][k] = curr_trip_arr_time;
-                    earliest_stop_arrival_times[next_stop] = min(earliest_stop_arrival_times[next_stop], curr_trip_arr_time);
-
-                    route_taken[{next_stop, k}] = { boarding_stop, k - 1, current_trip, 0 };
-
-                    marked_stops.insert(next_stop);
-                }
-            }
+        // Each pattern is scanned from its earliest marked position, the first
+        // trip searched for from the one it was ridden on last round. Pruned,
+        // an arrival must beat the stop's and the destination's earliest
+        // arrivals, since only then can it lead to a better journey.
+        for (uint32_t pattern : Q) {
+            const uint32_t first_pos = Q_positions[pattern];
+            Q_positions[pattern] = NO_INDEX;
+            const uint32_t *pattern_stops = TT.stops_of(pattern);
+
+            uint32_t last_trip = scan_pattern(pattern, first_pos, ws.previous_trip(pattern),
+                [&](uint32_t stop) { return previous_labels[stop]; },
+                [&](uint32_t stop) {
+                    return prune ? min(earliest_stop_arrival_times[stop], earliest_stop_arrival_times[dest_stop])
+                                 : labels[stop];
+                },
+                [&](uint32_t stop, int arrival, uint32_t trip, int board_pos) {
+                    LabelEntry &entry = set_label(stop, arrival, k, previous_entries[pattern_stops[board_pos]]);
+                    entry.trip = trip;
+                    entry.board_pos = board_pos;
+                    marked_stops.insert(stop);
+                });
+            if (last_trip != NO_INDEX)
+                ws.set_previous_trip(pattern, last_trip);
         }
-
-        unordered_set<int> marked_stops_temp;
-        for (int stop : marked_stops) {
-            if (Transfers.find(stop) == Transfers.end()) continue;
-
-            int base_prev_time = stop_arrival_times[stop][k - 1];
-            if (base_prev_time == numeric_limits<int>::max()) continue;
-
-            for (const auto& w : Transfers[stop]) {
-                int walkable_stop = w.first;
-                int walk_time = w.second;
-                int curr_walk_arr_time = base_prev_time + walk_time;
-
-                if (curr_walk_arr_time < stop_arrival_times[walkable_stop][k]) {
-                    stop_arrival_times[walkable_stop][k] = curr_walk_arr_time;
-                    earliest_stop_arrival_times[walkable_stop] = min(earliest_stop_arrival_times[walkable_stop], curr_walk_arr_time);
-
-                    route_taken[{walkable_stop, k}] = { stop, k - 1, "walk", walk_time };
-                    
-                    marked_stops_temp.insert(walkable_stop);
-                }
-            }
+        Q.clear();
+
+        walk_marked_stops(marked_stops, ws.walk_marked_stops, ws.trip_labels,
+                          [&](uint32_t stop) { return ws.entries[stop]; },
+                          [&](uint32_t stop, uint32_t entry, MarkedSet &marked) {
+            walk_from(stop, k, log[entry].time, entry, marked);
+        });
+
+        // pruned, the search ends once no marked stop is reached before the
+        // destination: every journey on from one arrives later
+        if (prune && none_of(marked_stops.begin(), marked_stops.end(), [&](uint32_t stop) {
+                return labels[stop] < earliest_stop_arrival_times[dest_stop];
+            })) {
+            break;
         }
-
-        marked_stops.insert(marked_stops_temp.begin(), marked_stops_temp.end());
-
         if (marked_stops.empty()) {
             break;
         }
     }
 
-    int best_time = earliest_stop_arrival_times[dest_stop];
-
-    if (best_time == numeric_limits<int>::max()) {
-        return { -1, {} };
+    if (dest_entry == NO_INDEX) {
+        return Journey();
     }
+    return Journey(&ws, dest_entry, dest_round, log[dest_entry].time);
+}
 
-    int rounds_taken = -1;
-    for (int k = 0; k < K + 1; ++k) {
-        if (stop_arrival_times[dest_stop][k] == best_time) {
-            rounds_taken = k;
-            break;
-        }
+template <int... Ks>
+static vector<RaptorEngine> specialise(integer_sequence<int, Ks...>) {
+    return vector<RaptorEngine>{
+        { 0, Pruning::none, search<0, false> },
+        { 0, Pruning::full, search<0, true> },
+        { Ks, Pruning::none, search<Ks, false> }...,
+        { Ks, Pruning::full, search<Ks, true> }...,
+    };
+}
+
+const vector<RaptorEngine> &raptor_engines() {
+    static const vector<RaptorEngine> engines = specialise(integer_sequence<int, 1, 2, 3, 4, 5, 6, 7, 8>());
+    return engines;
+}
+
+RaptorEngineFn raptor_engine(int K, Pruning pruning) {
+    const vector<RaptorEngine> &engines = raptor_engines();
+    // generic engines first, so that the last match is the most specialised one
+    RaptorEngineFn fn = nullptr;
+    for (const RaptorEngine &engine : engines) {
+        if (engine.pruning == pruning && (engine.max_rounds == 0 || engine.max_rounds == K)) fn = engine.fn;
     }
+    return fn;
+}
 
-    vector<PathStep> path;
-    int curr_stop = dest_stop;
-    int curr_round = rounds_taken;
+template <typename F>
+void Journey::trace(F f) const {
+    if (!found()) return;
+    trace_legs(workspace->log, entry, f);
+}
 
-    while (route_taken.find({curr_stop, curr_round}) != route_taken.end()) {
-        const TakenStep& taken_step = route_taken[{curr_stop, curr_round}];
+uint32_t Journey::num_legs() const {
+    uint32_t count = 0;
+    trace([&](const Leg &) { ++count; });
+    return count;
+}
 
-        int prev_stop = taken_step.prev_stop;
-        int prev_round = taken_step.prev_round;
-        const string& mode = taken_step.mode;
-        int walk_time = taken_step.walk_time;
+vector<Leg> Journey::legs() const {
+    vector<Leg> legs;
+    trace([&](const Leg &leg) { legs.push_back(leg); });
+    reverse(legs.begin(), legs.end());
+    return legs;
+}
 
+vector<PathStep> Journey::path() const {
+    return path_of(legs());
+}
+
+vector<PathStep> path_of(const vector<Leg> &legs) {
+    vector<PathStep> path;
+    int k = 0; // round of the label each leg ends at
+    for (const Leg &leg : legs) {
         PathStep step;
-        if (mode == "walk") {
-            step.type = "walk";
-            step.stop1 = prev_stop;
-            step.stop2 = curr_stop;
-            step.trip_id = "";
-            step.walk_time = walk_time;
-            step.start_time = stop_arrival_times[prev_stop][prev_round];
-            step.end_time = stop_arrival_times[curr_stop][curr_round];
-            step.round = curr_round;
+        step.type = leg.type;
+        step.stop1 = TT.stop_ids[leg.from_stop];
+        step.stop2 = TT.stop_ids[leg.to_stop];
+        step.start_time = leg.start_time;
+        step.end_time = leg.end_time;
+        if (leg.type == LegType::walk) {
+            step.walk_time = leg.end_time - leg.start_time;
         } else {
-            step.type = "bus/train";
-            step.stop1 = prev_stop;
-            step.stop2 = curr_stop;
-            step.trip_id = mode;
+            step.trip_id = string(TT.trip_ids[leg.trip]);
             step.walk_time = 0;
-
-            const auto& stops_map = Trips[mode].stops;
-
-            if (stops_map.count(prev_stop) && stops_map.count(curr_stop)) {
-                step.start_time = stops_map.at(prev_stop).second;
-                step.end_time = stops_map.at(curr_stop).first;
-            } else {
-                step.start_time = 0;
-                step.end_time = 0;
-            }
-
-            step.round = curr_round;
+            ++k;
         }
+        step.round = k;
         path.push_back(step);
-
-        curr_stop  = prev_stop;
-        curr_round = prev_round;
     }
-
-    reverse(path.begin(), path.end());
-    return { best_time, path };
+    return path;
 }
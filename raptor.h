@@ -6,11 +6,16 @@
 #include <algorithm>
 #include <tuple>
 #include "gtfs.h"
+#include "timetable.h"
+#include "marked_set.h"
 
 using namespace std;
 
+enum class LegType : uint8_t { walk, trip };
+
+// One leg of a journey as a traveller reads it: GTFS stop ids and trip id.
 struct PathStep {
-    string type;
+    LegType type;
     int stop1;
     int stop2;
     string trip_id;
@@ -20,6 +25,154 @@ struct PathStep {
     int round;
 };
 
-string earliest_trip(const string& route_id, int board_stop, int board_time);
+// A label raptor() set: `stop` reached at `time` by riding `trip`, boarded at
+// position board_pos of its pattern, or by walking walk_time seconds, from the
+// stop of the label logged as `parent`.
+struct LabelEntry {
+    uint32_t stop;
+    int32_t time;
+    uint32_t parent; // index in the log; NO_INDEX for the source's label
+    uint32_t trip;   // NO_INDEX for a footpath
+    union {
+        uint32_t board_pos; // trips
+        int32_t walk_time;  // footpaths
+    };
+};
+
+// Scratch memory of raptor(), kept from one query to the next so that a query
+// allocates nothing once the workspace has grown to the timetable. Round k
+// only reads the labels of round k-1, so only those and round k's are kept,
+// with each stop's earliest arrival over all rounds; journeys are traced back
+// through a log of every label set. A query thus holds O(stops + labels set),
+// not O(K * stops), and begin() puts back to NO_TIME only the stops in the
+// log. The trips boarded on patterns are valid only under the current epoch.
+struct QueryWorkspace {
+    // Readies the workspace for a query on TT.
+    void begin();
+
+    uint32_t previous_trip(uint32_t pattern) const {
+        return pattern_epochs[pattern] == epoch ? previous_trips[pattern] : NO_INDEX;
+    }
+    void set_previous_trip(uint32_t pattern, uint32_t trip) {
+        pattern_epochs[pattern] = epoch;
+        previous_trips[pattern] = trip;
+    }
+
+    uint32_t epoch = 0;
+    vector<int32_t> previous_labels, labels;   // [stop], arrivals in rounds k-1 and k
+    vector<uint32_t> previous_entries, entries; // [stop], where those labels are in the log
+    vector<int32_t> earliest;                   // [stop], the earliest arrival over all rounds
+    vector<LabelEntry> log;                     // labels set, in order, round after round
+    vector<uint32_t> round_starts;              // [k], index in the log of round k's first label
+    vector<uint32_t> previous_trips, pattern_epochs; // [pattern], trip boarded in the previous round
+
+    // per-round scratch, cleared but not freed
+    MarkedSet marked_stops, walk_marked_stops;
+    MarkedSet Q;                   // patterns to scan in a round
+    vector<uint32_t> Q_positions;  // [pattern], where to scan from; NO_INDEX when not in Q
+    vector<uint32_t> improved;
+    vector<pair<uint32_t,uint32_t>> trip_labels; // (stop, log entry)
+};
+
+// One leg of a journey in dense indices: a trip from from_stop to to_stop, or
+// a walk between them (trip NO_INDEX).
+struct Leg {
+    LegType type;
+    uint32_t from_stop, to_stop;
+    uint32_t trip;
+    int32_t start_time, end_time;
+};
+
+// Legs in travel order with GTFS ids, for printing.
+vector<PathStep> path_of(const vector<Leg> &legs);
+
+// Calls f(leg) for the legs of the journey ending at the label logged as
+// `entry`, from the last leg back to the first. Each logged label records the
+// step that ends at its time and the label the step started from.
+template <typename F>
+void trace_legs(const vector<LabelEntry> &log, uint32_t entry, F f) {
+    for (const LabelEntry *e = &log[entry]; e->parent != NO_INDEX; e = &log[e->parent]) {
+        const uint32_t from_stop = log[e->parent].stop;
+        if (e->trip == NO_INDEX) {
+            f(Leg{ LegType::walk, from_stop, e->stop, NO_INDEX, e->time - e->walk_time, e->time });
+        } else {
+            f(Leg{ LegType::trip, from_stop, e->stop, e->trip, TT.departure(e->trip, e->board_pos), e->time });
+        }
+    }
+}
+
+// Result of a query. It points into the label log of the workspace that ran
+// the query, so it stays valid until that workspace runs the next one. Arrival
+// and trip count are at hand; legs are traced back through the log, and their
+// ids looked up, only when asked for.
+class Journey {
+public:
+    Journey() = default;
+    Journey(const QueryWorkspace *workspace, uint32_t entry, int round, int arrival_time)
+        : workspace(workspace), entry(entry), round(round), arrival_time(arrival_time) {}
+
+    bool found() const { return arrival_time != -1; }
+    int arrival() const { return arrival_time; } // -1 if the destination was not reached
+    int trips() const { return found() ? round : 0; }
+    uint32_t num_legs() const;
+
+    vector<Leg> legs() const;         // in travel order
+    vector<PathStep> path() const;    // legs() with GTFS ids, for printing
+
+private:
+    template <typename F>
+    void trace(F f) const;            // f(leg) from the last leg back to the first
+
+    const QueryWorkspace *workspace = nullptr;
+    uint32_t entry = NO_INDEX;        // the destination's label in the log
+    int round = -1;                   // round that label was set in
+    int arrival_time = -1;
+};
+
+// Earliest trip of `pattern` departing its stop at position `stop_pos` no earlier
+// than `board_time`, NO_INDEX if there is none. Searches the sorted departure
+// column with the first_at_least kernel picked for this CPU; the second form
+// gallops outwards from the trip `hint` first.
+uint32_t earliest_trip(uint32_t pattern, uint32_t stop_pos, int board_time);
+uint32_t earliest_trip(uint32_t pattern, uint32_t stop_pos, int board_time, uint32_t hint);
+
+// How far raptor_journey() bounds its search. `full` is the pruning of the
+// RAPTOR paper: a stop is labelled in round k only if it is reached before its
+// earliest arrival in any round (local pruning) and before the destination's
+// (target pruning), and the rounds end once no marked stop is reached before
+// the destination. `none` only keeps each round's labels improving and cuts off
+// walks that end after the destination's best arrival. Both find the same
+// arrivals when the footpaths are closed (TT.transfer_closure): otherwise a stop
+// a trip reaches too late for a label is not walked from, and the longer walk
+// chains it would have continued are missed.
+enum class Pruning { none, full };
+
+// Earliest arrival at dest_stop leaving source_stop at departure_time with at
+// most K trips. The first form works in `workspace`, the second in one kept per
+// thread, which the journey then points into until the thread's next query.
+Journey raptor_journey(QueryWorkspace &workspace, int source_stop, int dest_stop, int departure_time, int K,
+                       Pruning pruning = Pruning::none);
+Journey raptor_journey(int source_stop, int dest_stop, int departure_time, int K, Pruning pruning = Pruning::none);
+
+// Search engines compiled for a fixed round limit (max_rounds, K = 1..8) and
+// pruning mode, and generic ones (max_rounds 0) taking any K. An engine takes
+// stop indices and runs in `workspace`; raptor_journey() picks one through
+// raptor_engine(), which falls back to the generic engine for other K.
+typedef Journey (*RaptorEngineFn)(QueryWorkspace &workspace, uint32_t source_stop, uint32_t dest_stop,
+                                  int departure_time, int K);
+
+struct RaptorEngine {
+    int max_rounds;
+    Pruning pruning;
+    RaptorEngineFn fn;
+};
+
+const vector<RaptorEngine> &raptor_engines();
+RaptorEngineFn raptor_engine(int K, Pruning pruning);
 
-pair<int, vector<PathStep>> raptor(int source_stop, int dest_stop, int departure_time, int K);
+// The same query with the journey written out; -1 and no steps when dest_stop
+// is not reached.
+pair<int, vector<PathStep>> raptor(QueryWorkspace &workspace, int source_stop, int dest_stop, int departure_time, int K,
+                                   Pruning pruning = Pruning::none);
+pair<int, vector<PathStep>> raptor(int source_stop, int dest_stop, int departure_time, int K,
+                                   Pruning pruning = Pruning::none);
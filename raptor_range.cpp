@@ -0,0 +1,163 @@
+#include "raptor_range.h"
+#include "trip_search.h"
+#include "route_scan.h"
+#include <omp.h>
+
+using namespace std;
+
+void RangeWorkspace::begin(int K) {
+    rounds = K + 1;
+    labels.assign(size_t(TT.num_stops()) * rounds, NO_TIME);
+    if (marked_stops.capacity() != TT.num_stops()) {
+        marked_stops.resize(TT.num_stops());
+        walk_marked_stops.resize(TT.num_stops());
+    }
+    marked_stops.clear();
+    walk_marked_stops.clear();
+    if (Q.capacity() != TT.num_patterns()) {
+        Q.resize(TT.num_patterns());
+        Q_positions.assign(TT.num_patterns(), NO_INDEX);
+    }
+}
+
+static RangeWorkspace &thread_range_workspace() {
+    static thread_local RangeWorkspace workspace;
+    return workspace;
+}
+
+// Departures from `source` in [t_begin, t_end] worth trying: those of the trips
+// at the source and, less the walk, at the stops one footpath away. Latest first.
+static vector<int> source_departures(uint32_t source, int t_begin, int t_end) {
+    vector<int> departures;
+    auto add_stop = [&](uint32_t stop, int walk_time) {
+        for (uint32_t i = TT.stop_pattern_offsets[stop]; i < TT.stop_pattern_offsets[stop + 1]; ++i) {
+            const uint32_t pattern = TT.stop_patterns[i], position = TT.stop_pattern_positions[i];
+            if (position + 1 == TT.pattern_size(pattern)) continue; // nothing to ride to
+            const int32_t *column = TT.stop_departures(pattern, position);
+            const uint32_t num_trips = TT.pattern_trip_count(pattern);
+            const uint32_t first = first_at_least(column, num_trips, t_begin + walk_time);
+            for (uint32_t t = first; t < num_trips && column[t] - walk_time <= t_end; ++t)
+                departures.push_back(column[t] - walk_time);
+        }
+    };
+    add_stop(source, 0);
+    for (uint32_t i = TT.transfer_offsets[source]; i < TT.transfer_offsets[source + 1]; ++i)
+        add_stop(TT.transfer_targets[i], TT.transfer_walk_times[i]);
+
+    sort(departures.begin(), departures.end(), greater<int>());
+    departures.erase(unique(departures.begin(), departures.end()), departures.end());
+    return departures;
+}
+
+// One departure of rRAPTOR on the labels the later departures of the window
+// left. A label holds the earliest arrival with at most k trips, so setting it
+// lowers the labels of the later rounds it beats too; a stop is then labelled
+// in round k only if that improves on every journey with at most k trips to it
+// and to the destination (local and target pruning). Appends the journeys to
+// dest that this departure improves.
+static void run_departure(RangeWorkspace &ws, uint32_t source, uint32_t dest, int departure, int K,
+                          vector<ProfileJourney> &profile) {
+    const int rounds = ws.rounds;
+    int32_t *labels = ws.labels.data();
+    int32_t *dest_labels = labels + size_t(dest) * rounds;
+    vector<int32_t> &dest_before = ws.dest_before;
+    dest_before.assign(dest_labels, dest_labels + rounds);
+
+    auto set_label = [&](uint32_t stop, int32_t time, int k) {
+        int32_t *stop_labels = labels + size_t(stop) * rounds;
+        for (int j = k; j < rounds && time < stop_labels[j]; ++j)
+            stop_labels[j] = time;
+    };
+
+    // footpaths from `stop`, walked from its round k label `base`
+    auto walk_from = [&](uint32_t stop, int k, int base, MarkedSet &marked) {
+        walk_footpaths(stop, base, dest_labels[k], labels + k, rounds, ws.improved,
+                       [&](uint32_t target, int walk_time) {
+            set_label(target, base + walk_time, k);
+            marked.insert(target);
+        });
+    };
+
+    MarkedSet &marked_stops = ws.marked_stops;
+    marked_stops.clear();
+    set_label(source, departure, 0);
+    marked_stops.insert(source);
+    walk_from(source, 0, departure, marked_stops);
+
+    for (int k = 1; k <= K && !marked_stops.empty(); ++k) {
+        MarkedSet &Q = ws.Q;
+        uint32_t *Q_positions = ws.Q_positions.data();
+        // the windows already run on their own threads
+        collect_patterns(marked_stops, Q, Q_positions, false, [](uint32_t) { return false; });
+        marked_stops.clear();
+
+        // the route scan of raptor_journey(), boarding from round k-1's labels
+        for (uint32_t pattern : Q) {
+            const uint32_t first_pos = Q_positions[pattern];
+            Q_positions[pattern] = NO_INDEX;
+            scan_pattern(pattern, first_pos, NO_INDEX,
+                [&](uint32_t stop) { return labels[size_t(stop) * rounds + k - 1]; },
+                [&](uint32_t stop) { return min(labels[size_t(stop) * rounds + k], dest_labels[k]); },
+                [&](uint32_t stop, int arrival, uint32_t, int) {
+                    set_label(stop, arrival, k);
+                    marked_stops.insert(stop);
+                });
+        }
+        Q.clear();
+
+        walk_marked_stops(marked_stops, ws.walk_marked_stops, ws.trip_labels,
+                          [&](uint32_t stop) { return labels[size_t(stop) * rounds + k]; },
+                          [&](uint32_t stop, int32_t base, MarkedSet &marked) { walk_from(stop, k, base, marked); });
+    }
+
+    // a journey with k trips counts when this departure improved it and it
+    // beats every journey with fewer trips
+    for (int k = 0; k < rounds; ++k) {
+        if (dest_labels[k] < dest_before[k] && (k == 0 || dest_labels[k] < dest_labels[k - 1]))
+            profile.push_back(ProfileJourney{ departure, dest_labels[k], k });
+    }
+}
+
+vector<ProfileJourney> raptor_range(int source_stop_id, int dest_stop_id, int t_begin, int t_end, int K,
+                                    int num_windows) {
+    const uint32_t source = stop_index(source_stop_id);
+    const uint32_t dest = stop_index(dest_stop_id);
+    if (source == NO_INDEX || dest == NO_INDEX || t_begin > t_end) {
+        return {};
+    }
+
+    const vector<int> departures = source_departures(source, t_begin, t_end);
+    num_windows = max(1, min<int>(num_windows, departures.size()));
+
+    // window w runs departures [bounds[w], bounds[w + 1]), latest first
+    vector<size_t> bounds(num_windows + 1);
+    for (int w = 0; w <= num_windows; ++w)
+        bounds[w] = departures.size() * w / num_windows;
+
+    vector<vector<ProfileJourney>> window_profiles(num_windows);
+    #pragma omp parallel for schedule(dynamic) num_threads(num_windows) if (num_windows > 1)
+    for (int w = 0; w < num_windows; ++w) {
+        RangeWorkspace &ws = thread_range_workspace();
+        ws.begin(K);
+        for (size_t i = bounds[w]; i < bounds[w + 1]; ++i)
+            run_departure(ws, source, dest, departures[i], K, window_profiles[w]);
+    }
+
+    // Windows searched apart do not see the journeys of later windows, which
+    // may dominate theirs: going through the journeys latest departure first,
+    // one is kept only if it arrives before all kept ones with no more trips.
+    vector<ProfileJourney> profile;
+    vector<int> best(K + 1, NO_TIME); // [k], earliest arrival kept with at most k trips
+    for (const vector<ProfileJourney> &window : window_profiles) {
+        for (const ProfileJourney &journey : window) {
+            if (journey.arrival >= best[journey.trips]) continue;
+            profile.push_back(journey);
+            for (int k = journey.trips; k <= K; ++k)
+                best[k] = min(best[k], journey.arrival);
+        }
+    }
+    sort(profile.begin(), profile.end(), [](const ProfileJourney &a, const ProfileJourney &b) {
+        return a.departure != b.departure ? a.departure < b.departure : a.trips < b.trips;
+    });
+    return profile;
+}
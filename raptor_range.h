@@ -0,0 +1,53 @@
+#ifndef RAPTOR_RANGE_H
+#define RAPTOR_RANGE_H
+
+#include <cstdint>
+#include <vector>
+#include "raptor.h"
+
+// A journey of a profile: leaving the source at `departure`, it reaches the
+// destination at `arrival` riding `trips` trips. raptor_journey() from the
+// source at `departure` with K = trips traces its legs.
+struct ProfileJourney {
+    int departure;
+    int arrival;
+    int trips;
+};
+
+// Scratch memory of raptor_range(), one per thread running a sub-window. The
+// departures of a window reuse its labels, one per stop and round, stored
+// stop by stop so that a stop's rounds share a cache line.
+struct RangeWorkspace {
+    // Readies the workspace for a window on TT with at most K trips.
+    void begin(int K);
+
+    int rounds = 0;         // K + 1
+    vector<int32_t> labels; // [stop * rounds + k], arrival with at most k trips
+    MarkedSet marked_stops, walk_marked_stops;
+    MarkedSet Q;                  // patterns to scan in a round
+    vector<uint32_t> Q_positions; // [pattern], where to scan from; NO_INDEX when not in Q
+    vector<uint32_t> improved;
+    vector<pair<uint32_t,int32_t>> trip_labels; // (stop, arrival)
+    vector<int32_t> dest_before;                // [k], the destination's labels before a departure
+};
+
+// Departures from source_stop in [t_begin, t_end], given as seconds after
+// midnight, that reach dest_stop with at most K trips and are Pareto optimal
+// in (later departure, earlier arrival, fewer trips), ordered by departure and
+// then trips; no journey departs later, arrives no later and rides no more
+// trips than one of them. The departures tried are those of the trips at the
+// source and at the stops one footpath from it.
+//
+// This is rRAPTOR: the departures are run from the latest to the earliest,
+// and each starts from the labels the later ones left, as a journey leaving
+// later can also be made leaving earlier. Only the stops a departure improves
+// are scanned from. The departures are split into `num_windows` runs of
+// consecutive ones, each searched on its own thread from fresh labels, and
+// the journeys of later windows that dominate those of earlier ones are
+// merged out. As with Pruning::full, a stop a trip reaches too late for a
+// label is not walked from, so the profile is exact when the footpaths are
+// closed (TT.transfer_closure).
+vector<ProfileJourney> raptor_range(int source_stop, int dest_stop, int t_begin, int t_end, int K,
+                                    int num_windows = 1);
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef ROUTE_SCAN_H
+#define ROUTE_SCAN_H
+
+#include <cstdint>
+#include <vector>
+#include <omp.h>
+#include "raptor.h"
+#include "trip_search.h"
+#include "footpath_relax.h"
+
+// The steps of a RAPTOR round shared by raptor_journey() and raptor_range(),
+// which differ only in where their labels live. They are reached through the
+// callbacks, which inline into the engines' loops.
+
+// Q: the patterns serving the marked stops, each with the earliest position
+// at which it does, but for the stops skip(stop) passes over. With `parallel`,
+// many marked stops are split over the threads.
+template <typename Skip>
+void collect_patterns(const MarkedSet &marked_stops, MarkedSet &Q, uint32_t *Q_positions, bool parallel, Skip skip) {
+    if (!parallel || marked_stops.size() <= 200) {
+        for (uint32_t marked_stop : marked_stops) {
+            if (skip(marked_stop)) continue;
+            for (uint32_t i = TT.stop_pattern_offsets[marked_stop]; i < TT.stop_pattern_offsets[marked_stop + 1]; ++i) {
+                uint32_t pattern = TT.stop_patterns[i];
+                Q.insert(pattern);
+                Q_positions[pattern] = min(Q_positions[pattern], TT.stop_pattern_positions[i]);
+            }
+        }
+    } else {
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < (int)marked_stops.size(); i++) {
+            uint32_t marked_stop = marked_stops[i];
+            if (skip(marked_stop)) continue;
+
+            for (uint32_t j = TT.stop_pattern_offsets[marked_stop]; j < TT.stop_pattern_offsets[marked_stop + 1]; ++j) {
+                uint32_t pattern = TT.stop_patterns[j];
+                uint32_t position = TT.stop_pattern_positions[j];
+                Q.insert_atomic(pattern);
+
+                uint32_t earliest = __atomic_load_n(&Q_positions[pattern], __ATOMIC_RELAXED);
+                while (position < earliest &&
+                       !__atomic_compare_exchange_n(&Q_positions[pattern], &earliest, position, true,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                }
+            }
+        }
+    }
+}
+
+// Scans `pattern` from position first_pos, riding the earliest trip that can
+// be caught so far. Wherever board_time(stop), the previous round's label,
+// is in time for the ridden trip, the earliest trip catchable there may be an
+// earlier one: the search gallops down from the ridden trip, as no later trip
+// can be the answer, and the scan switches to it. The first search gallops
+// from `hint`. An arrival earlier than bound(stop), and no earlier than the
+// departure boarded, is passed to arrive(stop, arrival, trip, board_pos).
+// Returns the trip ridden last, NO_INDEX if none was.
+template <typename BoardTime, typename Bound, typename Arrive>
+uint32_t scan_pattern(uint32_t pattern, uint32_t first_pos, uint32_t hint, BoardTime board_time, Bound bound,
+                      Arrive arrive) {
+    const uint32_t *pattern_stops = TT.stops_of(pattern);
+    const int pattern_len = TT.pattern_size(pattern);
+    // departures of trip t at position i: pattern_departures[i * num_trips + t - first_trip]
+    const int32_t *pattern_departures = TT.stop_departures(pattern, 0);
+    const uint32_t first_trip = TT.pattern_trip_offsets[pattern], num_trips = TT.pattern_trip_count(pattern);
+
+    uint32_t current_trip = NO_INDEX;
+    const int32_t *trip_arrivals = nullptr;
+    int boarding_pos = -1, boarding_departure = 0;
+
+    for (int idx = first_pos; idx < pattern_len; idx++) {
+        const uint32_t next_stop = pattern_stops[idx];
+
+        if (current_trip != NO_INDEX) {
+            int arrival = trip_arrivals[idx];
+            if (arrival >= boarding_departure && arrival < bound(next_stop))
+                arrive(next_stop, arrival, current_trip, boarding_pos);
+        }
+
+        int boarding_time = board_time(next_stop);
+        if (boarding_time == NO_TIME)
+            continue;
+        if (current_trip != NO_INDEX &&
+            boarding_time > pattern_departures[size_t(idx) * num_trips + current_trip - first_trip])
+            continue;
+
+        uint32_t earliest = earliest_trip(pattern, idx, boarding_time, current_trip != NO_INDEX ? current_trip : hint);
+        if (earliest == NO_INDEX || earliest == current_trip)
+            continue;
+
+        current_trip = earliest;
+        trip_arrivals = TT.trip_arrivals(current_trip);
+        boarding_pos = idx;
+        boarding_departure = pattern_departures[size_t(idx) * num_trips + current_trip - first_trip];
+    }
+    return current_trip;
+}
+
+// Footpaths from `stop`, walked from a label `base`, to the targets whose
+// label (labels[target * stride]) they improve: walk(target, walk_time) for
+// each, in walk time order. They are ordered by walk time, so the walks
+// reaching `cutoff` or later, which cannot lead to an earlier arrival, are cut
+// off with a single search.
+template <typename Walk>
+void walk_footpaths(uint32_t stop, int32_t base, int32_t cutoff, const int32_t *labels, uint32_t stride,
+                    vector<uint32_t> &improved, Walk walk) {
+    const uint32_t first_transfer = TT.transfer_offsets[stop];
+    const uint32_t *targets = TT.transfer_targets.data() + first_transfer;
+    const int32_t *walk_times = TT.transfer_walk_times.data() + first_transfer;
+    const uint32_t useful = first_at_least(walk_times, TT.transfer_offsets[stop + 1] - first_transfer, cutoff - base);
+    if (improved.size() < useful) improved.resize(useful);
+
+    uint32_t count = relax_footpaths(targets, walk_times, useful, base, labels, stride, improved.data());
+    for (uint32_t j = 0; j < count; ++j)
+        walk(targets[improved[j]], walk_times[improved[j]]);
+}
+
+// Walks start from the labels the trips of the round set, read(stop) for the
+// marked stops, read before any walk changes them; walk_from(stop, label,
+// walk_marked) marks the stops it improves, which then join marked_stops. A
+// stop a walk improves is not walked from again this round, which misses no
+// stop within TT.transfer_closure seconds of walking when the footpaths are
+// closed.
+template <typename T, typename Read, typename WalkFrom>
+void walk_marked_stops(MarkedSet &marked_stops, MarkedSet &walk_marked, vector<pair<uint32_t, T>> &trip_labels,
+                       Read read, WalkFrom walk_from) {
+    trip_labels.clear();
+    for (uint32_t stop : marked_stops)
+        trip_labels.push_back({ stop, read(stop) });
+
+    walk_marked.clear();
+    for (auto [stop, label] : trip_labels)
+        walk_from(stop, label, walk_marked);
+    for (uint32_t stop : walk_marked)
+        marked_stops.insert(stop);
+}
+
+#endif
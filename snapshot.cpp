@@ -0,0 +1,245 @@
+#include "snapshot.h"
+#include "timetable.h"
+#include "mapped_file.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <type_traits>
+
+using namespace std;
+
+static const char SNAPSHOT_MAGIC[8] = { 'R', 'A', 'P', 'T', 'O', 'R', 'T', 'T' };
+// 2: footpaths ordered by walk time
+// 3: stop_pattern_positions
+static const uint32_t SNAPSHOT_VERSION = 3;
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+static const uint64_t SECTION_ALIGNMENT = 64;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;       // BYTE_ORDER_MARK as the writer stored it
+    uint64_t file_size;
+    uint32_t num_sections;
+    int32_t transfer_closure;  // Timetable::transfer_closure
+    uint64_t payload_checksum; // over every section's bytes, in section order
+    uint64_t header_checksum;  // over this header, with this field zero, and the section table
+};
+
+struct SnapshotSection {
+    uint64_t offset;           // from the start of the file
+    uint64_t count;            // elements
+    uint32_t element_size;
+    uint32_t reserved;
+};
+
+static uint64_t checksum(const char *data, size_t size, uint64_t h) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 32;
+    }
+    for (; i < size; ++i)
+        h = (h ^ static_cast<unsigned char>(data[i])) * 0x100000001B3ULL;
+    return h;
+}
+
+static uint64_t header_checksum(SnapshotHeader header, const vector<SnapshotSection> &sections) {
+    header.header_checksum = 0;
+    uint64_t h = checksum(reinterpret_cast<const char *>(&header), sizeof(header), 0xCBF29CE484222325ULL);
+    return checksum(reinterpret_cast<const char *>(sections.data()), sections.size() * sizeof(SnapshotSection), h);
+}
+
+static uint64_t align_up(uint64_t offset) {
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+struct ArrayBytes {
+    const char *data;
+    uint64_t count;
+    uint32_t element_size;
+};
+
+static vector<ArrayBytes> timetable_arrays(Timetable &tt) {
+    vector<ArrayBytes> arrays;
+    tt.for_each_array([&](auto &array) {
+        typedef typename remove_reference_t<decltype(array)>::value_type T;
+        arrays.push_back({ reinterpret_cast<const char *>(array.data()), array.size(), sizeof(T) });
+    });
+    return arrays;
+}
+
+bool write_snapshot(const string &path) {
+    vector<ArrayBytes> arrays = timetable_arrays(TT);
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.num_sections = arrays.size();
+    header.transfer_closure = TT.transfer_closure;
+    header.payload_checksum = 0xCBF29CE484222325ULL;
+
+    vector<SnapshotSection> sections;
+    uint64_t offset = align_up(sizeof(SnapshotHeader) + arrays.size() * sizeof(SnapshotSection));
+    for (const ArrayBytes &array : arrays) {
+        sections.push_back({ offset, array.count, array.element_size, 0 });
+        header.payload_checksum = checksum(array.data, array.count * array.element_size, header.payload_checksum);
+        offset = align_up(offset + array.count * array.element_size);
+    }
+    header.file_size = offset;
+    header.header_checksum = header_checksum(header, sections);
+
+    // written next to the target and renamed, so readers never map a half-written file
+    const string tmp_path = path + ".tmp";
+    ofstream out(tmp_path, ios::binary | ios::trunc);
+    if (!out.is_open()) {
+        cerr << "Cannot create snapshot " << tmp_path << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    const char padding[SECTION_ALIGNMENT] = {};
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(sections.data()), sections.size() * sizeof(SnapshotSection));
+    uint64_t written = sizeof(header) + sections.size() * sizeof(SnapshotSection);
+    for (size_t i = 0; i < arrays.size(); ++i) {
+        out.write(padding, sections[i].offset - written);
+        out.write(arrays[i].data, arrays[i].count * arrays[i].element_size);
+        written = sections[i].offset + arrays[i].count * arrays[i].element_size;
+    }
+    out.write(padding, header.file_size - written);
+    out.close();
+
+    if (!out || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        cerr << "Cannot write snapshot " << path << ": " << strerror(errno) << endl;
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Offsets arrays must agree with the arrays they index, or queries would read
+// out of bounds. Sizes and offset endpoints are checked first, then, in one
+// pass over the mapped contents, that offsets never decrease, that every stored
+// index is within the array it indexes and that every time block fits.
+static bool consistent(const Timetable &tt) {
+    const size_t stops = tt.stop_ids.size(), patterns = tt.pattern_routes.size(), trips = tt.trip_patterns.size();
+    auto closes = [](const FlatArray<uint32_t> &offsets, size_t count, size_t target_size) {
+        if (offsets.size() != count + 1 || offsets[0] != 0 || offsets[count] != target_size) return false;
+        for (size_t i = 0; i < count; ++i)
+            if (offsets[i] > offsets[i + 1]) return false;
+        return true;
+    };
+    auto below = [](const FlatArray<uint32_t> &indices, size_t bound) {
+        for (size_t i = 0; i < indices.size(); ++i)
+            if (indices[i] >= bound) return false;
+        return true;
+    };
+    if (!(tt.route_ids.closed() && tt.trip_ids.closed() && tt.trip_ids.size() == trips &&
+          closes(tt.pattern_stop_offsets, patterns, tt.pattern_stops.size()) &&
+          closes(tt.pattern_trip_offsets, patterns, trips) &&
+          closes(tt.stop_pattern_offsets, stops, tt.stop_patterns.size()) &&
+          tt.stop_pattern_positions.size() == tt.stop_patterns.size() &&
+          closes(tt.transfer_offsets, stops, tt.transfer_targets.size()) &&
+          tt.transfer_walk_times.size() == tt.transfer_targets.size() &&
+          tt.pattern_time_offsets.size() == patterns && tt.trip_time_offsets.size() == trips &&
+          tt.arrivals.size() == tt.departures.size())) {
+        return false;
+    }
+
+    // stop_index() bisects stop_ids
+    for (size_t i = 1; i < stops; ++i)
+        if (tt.stop_ids[i - 1] >= tt.stop_ids[i]) return false;
+    if (!below(tt.pattern_routes, tt.route_ids.size()) || !below(tt.pattern_stops, stops) ||
+        !below(tt.stop_patterns, patterns) || !below(tt.transfer_targets, stops)) {
+        return false;
+    }
+    for (size_t p = 0; p < patterns; ++p) {
+        const uint64_t size = tt.pattern_size(p), count = tt.pattern_trip_count(p);
+        if (tt.pattern_time_offsets[p] + size * count > tt.arrivals.size()) return false;
+        for (uint32_t t = tt.pattern_trip_offsets[p]; t < tt.pattern_trip_offsets[p + 1]; ++t) {
+            if (tt.trip_patterns[t] != p || tt.trip_time_offsets[t] + size > tt.arrivals.size()) return false;
+        }
+    }
+    for (size_t i = 0; i < tt.stop_patterns.size(); ++i)
+        if (tt.stop_pattern_positions[i] >= tt.pattern_size(tt.stop_patterns[i])) return false;
+    return true;
+}
+
+bool load_snapshot(const string &path, bool verify_payload) {
+    auto file = make_shared<MappedFile>();
+    if (!file->open(path)) {
+        cerr << "Cannot map snapshot " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    SnapshotHeader header;
+    if (file->size() < sizeof(header)) {
+        cerr << "Snapshot " << path << " is truncated" << endl;
+        return false;
+    }
+    memcpy(&header, file->data(), sizeof(header));
+
+    Timetable tt;
+    const size_t expected_sections = timetable_arrays(tt).size();
+
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        cerr << path << " is not a timetable snapshot" << endl;
+        return false;
+    }
+    if (header.version != SNAPSHOT_VERSION || header.byte_order != BYTE_ORDER_MARK ||
+        header.num_sections != expected_sections) {
+        cerr << "Snapshot " << path << " has format version " << header.version
+             << ", this build reads version " << SNAPSHOT_VERSION << " on this byte order" << endl;
+        return false;
+    }
+    if (header.file_size != file->size() ||
+        file->size() < sizeof(header) + expected_sections * sizeof(SnapshotSection)) {
+        cerr << "Snapshot " << path << " is truncated" << endl;
+        return false;
+    }
+
+    vector<SnapshotSection> sections(expected_sections);
+    memcpy(sections.data(), file->data() + sizeof(header), sections.size() * sizeof(SnapshotSection));
+    if (header_checksum(header, sections) != header.header_checksum) {
+        cerr << "Snapshot " << path << " has a corrupt header" << endl;
+        return false;
+    }
+
+    bool in_bounds = true;
+    uint64_t payload_checksum = 0xCBF29CE484222325ULL;
+    size_t i = 0;
+    tt.for_each_array([&](auto &array) {
+        typedef typename remove_reference_t<decltype(array)>::value_type T;
+        const SnapshotSection &section = sections[i++];
+        if (section.element_size != sizeof(T) || section.offset % alignof(T) != 0 || section.offset > file->size() ||
+            section.count > (file->size() - section.offset) / sizeof(T)) {
+            in_bounds = false;
+            return;
+        }
+        const char *bytes = file->data() + section.offset;
+        array.view(reinterpret_cast<const T *>(bytes), section.count);
+        if (verify_payload)
+            payload_checksum = checksum(bytes, section.count * sizeof(T), payload_checksum);
+    });
+
+    if (!in_bounds || !consistent(tt)) {
+        cerr << "Snapshot " << path << " has inconsistent sections" << endl;
+        return false;
+    }
+    if (verify_payload && payload_checksum != header.payload_checksum) {
+        cerr << "Snapshot " << path << " fails its payload checksum" << endl;
+        return false;
+    }
+
+    tt.transfer_closure = header.transfer_closure;
+    tt.mapping = file;
+    TT = move(tt);
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <string>
+
+// A snapshot is the compiled timetable TT written to one file, which a later run
+// maps and queries in place instead of parsing the GTFS feed again. The file is
+//
+//   SnapshotHeader | SnapshotSection[num_sections] | arrays, each 64-byte aligned
+//
+// with one section per Timetable array in for_each_array() order. Sections hold
+// file offsets only, so the mapping address does not matter. The header carries a
+// format version and checksums of the section table and of the array payload.
+
+// Writes TT to `path` (through a temporary file that is renamed into place).
+bool write_snapshot(const std::string &path);
+
+// Replaces TT with a view of the snapshot at `path`. Header, section table and
+// array bounds are always validated, and so, in one pass over the index arrays,
+// are the stored indices and offsets queries follow: a damaged snapshot fails
+// to load rather than read out of bounds later. The payload checksum, which
+// means reading the whole file, times included, only when `verify_payload` is
+// set. Problems go to stderr.
+bool load_snapshot(const std::string &path, bool verify_payload);
+
+#endif
@@ -0,0 +1,156 @@
+#include "time_parse.h"
+
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+
+using namespace std;
+
+// Unsigned decimal of 1 to max_digits digits at p, which it moves past them.
+static inline bool read_number(const char *&p, const char *end, int max_digits, int &value) {
+    const char *start = p;
+    value = 0;
+    while (p < end && p - start < max_digits && unsigned(*p - '0') < 10)
+        value = value * 10 + (*p++ - '0');
+    return p > start;
+}
+
+bool parse_time_field(string_view field, int &seconds) {
+    const char *p = field.data(), *end = field.data() + field.size();
+    while (p < end && (*p == ' ' || *p == '\t')) ++p;
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t')) --end;
+
+    seconds = 0;
+    if (p == end) return true;
+
+    int hours, mins, secs;
+    if (!read_number(p, end, 3, hours) || p == end || *p++ != ':' ||
+        !read_number(p, end, 2, mins) || p == end || *p++ != ':' ||
+        !read_number(p, end, 2, secs) || p != end)
+        return false;
+
+    seconds = hours * 3600 + mins * 60 + secs;
+    return true;
+}
+
+static size_t parse_time_column_scalar(const string_view *fields, size_t n, int32_t *seconds) {
+    for (size_t i = 0; i < n; ++i) {
+        int s;
+        if (!parse_time_field(fields[i], s)) return i;
+        seconds[i] = s;
+    }
+    return n;
+}
+
+// An HH:MM:SS field read as one little-endian word has its colons in bytes 2 and 5.
+static const uint64_t COLON_BYTES = 0x0000FF0000FF0000ULL;
+static const uint64_t COLONS = 0x00003A00003A0000ULL;
+static const uint64_t ZEROS = 0x3030303030303030ULL;
+
+// Seconds of an HH:MM:SS word, false if the word is anything else.
+static inline bool hhmmss_word(uint64_t w, int32_t &seconds) {
+    if ((w & COLON_BYTES) != COLONS) return false;
+
+    // with the colons read as '0', every byte must be a digit: high nibble 3, low nibble below 10
+    uint64_t x = (w & ~COLON_BYTES) | (ZEROS & COLON_BYTES);
+    const uint64_t high_nibbles = 0xF0F0F0F0F0F0F0F0ULL;
+    if ((x & high_nibbles) != ZEROS || ((x + 0x0606060606060606ULL) & high_nibbles) != ZEROS) return false;
+
+    // byte i of t is 10 * digit i + digit i+1, so bytes 0, 3 and 6 hold HH, MM and SS
+    uint64_t digits = x - ZEROS;
+    uint64_t t = digits * 10 + (digits >> 8);
+    seconds = (t & 0xFF) * 3600 + ((t >> 24) & 0xFF) * 60 + ((t >> 48) & 0xFF);
+    return true;
+}
+
+static size_t parse_time_column_swar(const string_view *fields, size_t n, int32_t *seconds) {
+    for (size_t i = 0; i < n; ++i) {
+        if (fields[i].size() == 8) {
+            uint64_t w;
+            memcpy(&w, fields[i].data(), 8);
+            if (hhmmss_word(w, seconds[i])) continue;
+        }
+        int s;
+        if (!parse_time_field(fields[i], s)) return i;
+        seconds[i] = s;
+    }
+    return n;
+}
+
+// Four HH:MM:SS fields per vector: check every byte, gather the digit pairs
+// into 16-bit lanes, and weigh them with two multiply-adds. Converts whole
+// groups of four from the start of fields[0..n) and returns how many fields it
+// converted, stopping at the first group holding any other kind of field. The
+// upper halves of the registers are cleared on the way out, since the callers
+// are SSE code.
+__attribute__((target("avx2"), noinline))
+static size_t hhmmss_groups_avx2(const string_view *fields, size_t n, int32_t *seconds) {
+    const __m256i zeros = _mm256_set1_epi8('0');
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i colon_bytes = _mm256_set1_epi64x(COLON_BYTES);
+    const __m256i colons = _mm256_set1_epi64x(COLONS);
+    const __m256i digit_pairs = _mm256_setr_epi8(0, 1, 3, 4, 6, 7, -1, -1, 8, 9, 11, 12, 14, 15, -1, -1,
+                                                 0, 1, 3, 4, 6, 7, -1, -1, 8, 9, 11, 12, 14, 15, -1, -1);
+    const __m256i tens = _mm256_set1_epi16(0x010A); // bytes 10, 1
+    const __m256i units = _mm256_setr_epi16(3600, 60, 1, 0, 3600, 60, 1, 0, 3600, 60, 1, 0, 3600, 60, 1, 0);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        if (fields[i].size() != 8 || fields[i + 1].size() != 8 || fields[i + 2].size() != 8 || fields[i + 3].size() != 8)
+            break;
+        uint64_t words[4];
+        for (int j = 0; j < 4; ++j)
+            memcpy(&words[j], fields[i + j].data(), 8);
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words));
+
+        __m256i digits = _mm256_sub_epi8(v, zeros);
+        __m256i digit_ok = _mm256_cmpeq_epi8(_mm256_min_epu8(digits, nine), digits);
+        __m256i colon_ok = _mm256_cmpeq_epi8(v, colons);
+        if (_mm256_movemask_epi8(_mm256_blendv_epi8(digit_ok, colon_ok, colon_bytes)) != -1) break;
+
+        __m256i hms = _mm256_maddubs_epi16(_mm256_shuffle_epi8(digits, digit_pairs), tens);
+        __m256i parts = _mm256_madd_epi16(hms, units);    // HH*3600 + MM*60, SS
+        __m256i sums = _mm256_hadd_epi32(parts, parts);   // per 128-bit lane: f0, f1, f0, f1
+        __m256i packed = _mm256_permute4x64_epi64(sums, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(seconds + i), _mm256_castsi256_si128(packed));
+    }
+    _mm256_zeroupper();
+    return i;
+}
+
+// Runs of fixed-width fields go through hhmmss_groups_avx2; a group it stops
+// at, and the tail, go through the SWAR kernel.
+static size_t parse_time_column_avx2(const string_view *fields, size_t n, int32_t *seconds) {
+    size_t i = 0;
+    while (true) {
+        i += hhmmss_groups_avx2(fields + i, n - i, seconds + i);
+        size_t group = min<size_t>(4, n - i);
+        size_t done = parse_time_column_swar(fields + i, group, seconds + i);
+        if (done < group) return i + done;
+        i += group;
+        if (i == n) return n;
+    }
+}
+
+const vector<TimeColumnKernel> &time_column_kernels() {
+    static const vector<TimeColumnKernel> kernels = [] {
+        __builtin_cpu_init();
+        return vector<TimeColumnKernel>{
+            { "scalar", parse_time_column_scalar, true },
+            { "swar", parse_time_column_swar, true },
+            { "avx2", parse_time_column_avx2, bool(__builtin_cpu_supports("avx2")) },
+        };
+    }();
+    return kernels;
+}
+
+static const TimeColumnKernel &best_kernel() {
+    const auto &kernels = time_column_kernels();
+    for (auto it = kernels.rbegin(); it != kernels.rend(); ++it) {
+        if (it->supported) return *it;
+    }
+    return kernels.front();
+}
+
+TimeColumnFn parse_time_column = best_kernel().fn;
+const char *parse_time_column_name = best_kernel().name;
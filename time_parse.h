@@ -0,0 +1,35 @@
+#ifndef TIME_PARSE_H
+#define TIME_PARSE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// GTFS H:MM:SS time of a raw field, in seconds past midnight of the service
+// day, so hours past 24 are kept. Surrounding blanks are allowed and an empty
+// field parses as 0. Returns false if the field is malformed.
+bool parse_time_field(std::string_view field, int &seconds);
+
+// Converts the time fields fields[0..n) into seconds[0..n). Returns the index
+// of the first malformed field, or n if there is none; earlier fields are
+// converted either way.
+typedef size_t (*TimeColumnFn)(const std::string_view *fields, size_t n, int32_t *seconds);
+
+struct TimeColumnKernel {
+    const char *name;
+    TimeColumnFn fn;
+    bool supported; // the CPU running us has the instructions this kernel needs
+};
+
+// Every compiled kernel, fastest last: scalar (parse_time_field per field),
+// swar (one 64-bit word per HH:MM:SS field) and avx2 (four fields per vector).
+// The fast kernels convert fixed-width HH:MM:SS fields themselves and hand
+// anything else (H:MM:SS, blanks, empty fields) to parse_time_field().
+const std::vector<TimeColumnKernel> &time_column_kernels();
+
+// Fastest supported kernel, chosen through CPUID when the program starts.
+extern TimeColumnFn parse_time_column;
+extern const char *parse_time_column_name;
+
+#endif
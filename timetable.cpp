@@ -0,0 +1,471 @@
+#include "timetable.h"
+#include "gtfs.h"
+#include "gtfs_csv.h"
+#include "time_parse.h"
+#include "footpaths.h"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+#include <omp.h>
+
+using namespace std;
+
+Timetable TT;
+
+StringTable &StringTable::operator=(const vector<string> &strings) {
+    vector<uint32_t> string_offsets = { 0 };
+    vector<char> string_chars;
+    for (const string &s : strings) {
+        string_chars.insert(string_chars.end(), s.begin(), s.end());
+        string_offsets.push_back(string_chars.size());
+    }
+    offsets = move(string_offsets);
+    chars = move(string_chars);
+    return *this;
+}
+
+uint32_t stop_index(int gtfs_stop_id) {
+    auto it = lower_bound(TT.stop_ids.begin(), TT.stop_ids.end(), gtfs_stop_id);
+    return it == TT.stop_ids.end() || *it != gtfs_stop_id ? NO_INDEX : it - TT.stop_ids.begin();
+}
+
+uint32_t route_index(string_view gtfs_route_id) {
+    uint32_t lo = 0, hi = TT.num_routes();
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (TT.route_ids[mid] < gtfs_route_id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < TT.num_routes() && TT.route_ids[lo] == gtfs_route_id ? lo : NO_INDEX;
+}
+
+// Stop sequence and times of one trip, in stop_times.txt order.
+struct TripStopTimes {
+    const string *trip_id = nullptr;
+    uint32_t route = NO_INDEX;
+    uint32_t size = 0;
+    const uint32_t *stops = nullptr;
+    const int32_t *arrivals = nullptr;
+    const int32_t *departures = nullptr;
+};
+
+// true if trip b never departs or arrives before trip a at any stop
+static bool runs_after(const TripStopTimes *a, const TripStopTimes *b) {
+    for (size_t i = 0; i < a->size; ++i) {
+        if (b->departures[i] < a->departures[i] || b->arrivals[i] < a->arrivals[i])
+            return false;
+    }
+    return true;
+}
+
+// Splits trips sharing a stop sequence into FIFO groups, in which trips sorted
+// by first departure stay sorted at every stop. Overtaking trips (an express
+// run on the local's stops, for example) go to a group of their own so that
+// every departure column of a pattern is sorted.
+static vector<vector<const TripStopTimes*>> split_fifo(vector<const TripStopTimes*> &trips) {
+    stable_sort(trips.begin(), trips.end(), [](const TripStopTimes *a, const TripStopTimes *b) {
+        return a->departures[0] < b->departures[0];
+    });
+
+    vector<vector<const TripStopTimes*>> groups;
+    for (const TripStopTimes *trip : trips) {
+        auto group = find_if(groups.begin(), groups.end(), [&](const vector<const TripStopTimes*> &g) {
+            return runs_after(g.back(), trip);
+        });
+        if (group == groups.end())
+            groups.push_back({ trip });
+        else
+            group->push_back(trip);
+    }
+    return groups;
+}
+
+// Pattern arrays of TT while they are being filled in.
+struct PatternArrays {
+    vector<string> trip_ids;
+    vector<uint32_t> pattern_routes;
+    vector<uint32_t> pattern_stop_offsets = { 0 };
+    vector<uint32_t> pattern_stops;
+    vector<uint32_t> pattern_trip_offsets = { 0 };
+    vector<uint32_t> trip_patterns;
+    vector<uint32_t> pattern_time_offsets;
+    vector<uint32_t> trip_time_offsets;
+    vector<int32_t> arrivals;
+    vector<int32_t> departures;
+};
+
+static void add_pattern(PatternArrays &out, uint32_t route, const vector<uint32_t> &stops,
+                        const vector<const TripStopTimes*> &trips) {
+    const uint32_t pattern = out.pattern_routes.size();
+    out.pattern_routes.push_back(route);
+    out.pattern_stops.insert(out.pattern_stops.end(), stops.begin(), stops.end());
+    out.pattern_stop_offsets.push_back(out.pattern_stops.size());
+
+    const size_t num_stops = stops.size();
+    const size_t num_trips = trips.size();
+    const size_t time_offset = out.arrivals.size();
+    out.pattern_time_offsets.push_back(time_offset);
+    out.arrivals.resize(time_offset + num_trips * num_stops);
+    out.departures.resize(time_offset + num_trips * num_stops);
+
+    for (size_t t = 0; t < num_trips; ++t) {
+        const TripStopTimes *trip = trips[t];
+        out.trip_ids.push_back(*trip->trip_id);
+        out.trip_patterns.push_back(pattern);
+        out.trip_time_offsets.push_back(time_offset + t * num_stops);
+
+        for (size_t i = 0; i < num_stops; ++i) {
+            out.arrivals[time_offset + t * num_stops + i] = trip->arrivals[i];
+            out.departures[time_offset + i * num_trips + t] = trip->departures[i];
+        }
+    }
+    out.pattern_trip_offsets.push_back(out.trip_ids.size());
+}
+
+// trips.txt: trips are numbered in order of first appearance and a repeated
+// trip_id keeps its first number and its last route.
+struct FeedTrips {
+    vector<TripHeaders> rows;
+    vector<const string*> ids;                // by trip number, views of rows
+    vector<uint32_t> routes;                  // route index of every trip
+    unordered_map<string_view, uint32_t> numbers;
+};
+
+static void read_trips(const string &path, FeedTrips &trips) {
+    parse_trips(path, trips.rows);
+
+    vector<string> route_ids;
+    for (auto &t : trips.rows)
+        route_ids.push_back(t.route_id);
+    sort(route_ids.begin(), route_ids.end());
+    route_ids.erase(unique(route_ids.begin(), route_ids.end()), route_ids.end());
+    TT.route_ids = route_ids;
+
+    trips.numbers.reserve(trips.rows.size());
+    for (auto &t : trips.rows) {
+        uint32_t route = lower_bound(route_ids.begin(), route_ids.end(), t.route_id) - route_ids.begin();
+        auto [it, inserted] = trips.numbers.try_emplace(t.trip_id, trips.ids.size());
+        if (inserted) {
+            trips.ids.push_back(&t.trip_id);
+            trips.routes.push_back(route);
+        } else {
+            trips.routes[it->second] = route;
+        }
+    }
+}
+
+static const size_t TIME_BATCH_ROWS = 64;
+
+// stop_times rows of one chunk of the file, as runs of consecutive rows of a trip.
+struct StopTimeRuns {
+    explicit StopTimeRuns(size_t max_rows = 0) {
+        stops.reserve(max_rows);
+        arrivals.reserve(max_rows);
+        departures.reserve(max_rows);
+        pending_times.reserve(2 * TIME_BATCH_ROWS);
+    }
+
+    vector<uint32_t> stops;
+    vector<int32_t> arrivals;
+    vector<int32_t> departures;
+    vector<pair<uint32_t, uint32_t>> runs; // (trip, first row of the run)
+    uint32_t last_trip = NO_INDEX;
+
+    // arrival and departure fields of the last rows, converted a batch at a time
+    vector<string_view> pending_times;
+};
+
+// Converts the pending times into the last rows of the chunk.
+static void convert_times(StopTimeRuns &chunk) {
+    const size_t num_rows = chunk.pending_times.size() / 2;
+    const size_t first_row = chunk.stops.size() - num_rows;
+    int32_t seconds[2 * TIME_BATCH_ROWS];
+
+    size_t done = parse_time_column(chunk.pending_times.data(), 2 * num_rows, seconds);
+    if (done < 2 * num_rows)
+        throw runtime_error("malformed time \"" + string(chunk.pending_times[done]) + "\"");
+    for (size_t i = 0; i < num_rows; ++i) {
+        chunk.arrivals[first_row + i] = seconds[2 * i];
+        chunk.departures[first_row + i] = seconds[2 * i + 1];
+    }
+    chunk.pending_times.clear();
+}
+
+// The stop_times rows of every trip. A trip whose rows are one run of a chunk,
+// which is nearly every trip, points into that chunk; the rows of the others
+// are gathered into the `gathered` arrays.
+struct TripRows {
+    vector<StopTimeRuns> chunks;
+    vector<uint32_t> gathered_stops;
+    vector<int32_t> gathered_arrivals;
+    vector<int32_t> gathered_departures;
+    vector<TripStopTimes> trips;
+};
+
+// Folds stop_times.txt into TripRows on all threads. Rows of trips missing
+// from trips.txt are dropped; stops keep their GTFS ids until compile_stops().
+static void read_stop_times(const string &path, const FeedTrips &trips, TripRows &out) {
+    CsvFile file(path, { "trip_id", "arrival_time", "departure_time", "stop_id" });
+
+    file.scan_rows(out.chunks, [&](const string_view *fields, StopTimeRuns &chunk) {
+        // rows of a trip are usually contiguous, which spares most hash lookups
+        if (chunk.last_trip == NO_INDEX || fields[0] != *trips.ids[chunk.last_trip]) {
+            auto it = trips.numbers.find(fields[0]);
+            chunk.last_trip = it == trips.numbers.end() ? NO_INDEX : it->second;
+            if (chunk.last_trip == NO_INDEX) return true;
+            chunk.runs.push_back({ chunk.last_trip, uint32_t(chunk.stops.size()) });
+        }
+
+        // A field with a quote cannot be a time; it would also be a view of the
+        // scratch string, which is gone by the time the batch is converted.
+        int stop_id;
+        if (!parse_int_field(fields[3], stop_id) || fields[1].find('"') != string_view::npos ||
+            fields[2].find('"') != string_view::npos)
+            return false;
+        chunk.stops.push_back(stop_id);
+        chunk.arrivals.push_back(0);
+        chunk.departures.push_back(0);
+        chunk.pending_times.push_back(fields[1]);
+        chunk.pending_times.push_back(fields[2]);
+        if (chunk.pending_times.size() == 2 * TIME_BATCH_ROWS)
+            convert_times(chunk);
+        return true;
+    });
+
+    vector<string> errors(out.chunks.size());
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t c = 0; c < out.chunks.size(); ++c) {
+        try {
+            convert_times(out.chunks[c]);
+        } catch (const exception &e) {
+            errors[c] = path + ": " + e.what();
+        }
+    }
+    for (const string &error : errors) {
+        if (!error.empty()) throw runtime_error(error);
+    }
+
+    auto run_end = [](const StopTimeRuns &chunk, size_t r) {
+        return r + 1 < chunk.runs.size() ? chunk.runs[r + 1].second : uint32_t(chunk.stops.size());
+    };
+
+    out.trips.resize(trips.ids.size());
+    vector<uint32_t> num_runs(trips.ids.size(), 0);
+    for (auto &chunk : out.chunks) {
+        for (size_t r = 0; r < chunk.runs.size(); ++r) {
+            auto [t, first] = chunk.runs[r];
+            TripStopTimes &trip = out.trips[t];
+            trip.size += run_end(chunk, r) - first;
+            if (num_runs[t]++ == 0) {
+                trip.stops = chunk.stops.data() + first;
+                trip.arrivals = chunk.arrivals.data() + first;
+                trip.departures = chunk.departures.data() + first;
+            }
+        }
+    }
+
+    // chunks are in file order, so gathered trips keep their rows in file order
+    vector<size_t> gathered_offset(trips.ids.size(), 0);
+    size_t num_gathered = 0;
+    for (uint32_t t = 0; t < trips.ids.size(); ++t) {
+        gathered_offset[t] = num_gathered;
+        if (num_runs[t] > 1) num_gathered += out.trips[t].size;
+    }
+    out.gathered_stops.resize(num_gathered);
+    out.gathered_arrivals.resize(num_gathered);
+    out.gathered_departures.resize(num_gathered);
+    for (auto &chunk : out.chunks) {
+        for (size_t r = 0; r < chunk.runs.size(); ++r) {
+            uint32_t t = chunk.runs[r].first;
+            if (num_runs[t] < 2) continue;
+            for (uint32_t i = chunk.runs[r].second; i < run_end(chunk, r); ++i, ++gathered_offset[t]) {
+                out.gathered_stops[gathered_offset[t]] = chunk.stops[i];
+                out.gathered_arrivals[gathered_offset[t]] = chunk.arrivals[i];
+                out.gathered_departures[gathered_offset[t]] = chunk.departures[i];
+            }
+        }
+    }
+
+    for (uint32_t t = 0; t < trips.ids.size(); ++t) {
+        TripStopTimes &trip = out.trips[t];
+        trip.trip_id = trips.ids[t];
+        trip.route = trips.routes[t];
+        if (num_runs[t] > 1) {
+            size_t first = gathered_offset[t] - trip.size;
+            trip.stops = out.gathered_stops.data() + first;
+            trip.arrivals = out.gathered_arrivals.data() + first;
+            trip.departures = out.gathered_departures.data() + first;
+        }
+    }
+}
+
+// Numbers the stops of stops.txt and any others that stop_times.txt uses, and
+// rewrites the GTFS stop ids of `rows` into those indices.
+static void compile_stops(const vector<StopHeaders> &stops, TripRows &rows) {
+    vector<int32_t> stop_ids;
+    for (auto &s : stops)
+        stop_ids.push_back(s.stop_id);
+
+    // sorted GTFS ids keep the numbering stable from run to run and let stop_index() bisect
+    sort(stop_ids.begin(), stop_ids.end());
+    stop_ids.erase(unique(stop_ids.begin(), stop_ids.end()), stop_ids.end());
+
+    auto renumber = [&](int32_t gtfs_stop_id) {
+        auto it = lower_bound(stop_ids.begin(), stop_ids.end(), gtfs_stop_id);
+        return it == stop_ids.end() || *it != gtfs_stop_id ? NO_INDEX : uint32_t(it - stop_ids.begin());
+    };
+
+    vector<vector<uint32_t>*> stop_columns = { &rows.gathered_stops };
+    for (auto &chunk : rows.chunks)
+        stop_columns.push_back(&chunk.stops);
+
+    // stops missing from stops.txt are rare, so look for them first and only then renumber
+    vector<int32_t> missing;
+    for (auto *column : stop_columns) {
+        for (uint32_t stop : *column) {
+            if (renumber(stop) == NO_INDEX)
+                missing.push_back(stop);
+        }
+    }
+    if (!missing.empty()) {
+        stop_ids.insert(stop_ids.end(), missing.begin(), missing.end());
+        sort(stop_ids.begin(), stop_ids.end());
+        stop_ids.erase(unique(stop_ids.begin(), stop_ids.end()), stop_ids.end());
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t c = 0; c < stop_columns.size(); ++c) {
+        for (uint32_t &stop : *stop_columns[c])
+            stop = renumber(stop);
+    }
+
+    TT.stop_ids = move(stop_ids);
+}
+
+static void compile_patterns(const TripRows &rows) {
+    // group trips of the same route by their exact stop sequence
+    map<pair<uint32_t, vector<uint32_t>>, vector<const TripStopTimes*>> patterns;
+    for (const TripStopTimes &trip : rows.trips) {
+        if (trip.size == 0) continue;
+        patterns[{trip.route, vector<uint32_t>(trip.stops, trip.stops + trip.size)}].push_back(&trip);
+    }
+
+    // sized up front: growing the time matrices would briefly double them
+    size_t num_times = 0;
+    for (const TripStopTimes &trip : rows.trips)
+        num_times += trip.size;
+    PatternArrays out;
+    out.arrivals.reserve(num_times);
+    out.departures.reserve(num_times);
+
+    for (auto &[key, trips] : patterns) {
+        for (auto &fifo_trips : split_fifo(trips))
+            add_pattern(out, key.first, key.second, fifo_trips);
+    }
+
+    TT.trip_ids = out.trip_ids;
+    TT.pattern_routes = move(out.pattern_routes);
+    TT.pattern_stop_offsets = move(out.pattern_stop_offsets);
+    TT.pattern_stops = move(out.pattern_stops);
+    TT.pattern_trip_offsets = move(out.pattern_trip_offsets);
+    TT.trip_patterns = move(out.trip_patterns);
+    TT.pattern_time_offsets = move(out.pattern_time_offsets);
+    TT.trip_time_offsets = move(out.trip_time_offsets);
+    TT.arrivals = move(out.arrivals);
+    TT.departures = move(out.departures);
+}
+
+static void compile_stop_patterns() {
+    // counted first, then filled pattern by pattern, so that each stop's visits
+    // come out in pattern order and, within a pattern, in stop order
+    vector<uint32_t> stop_pattern_offsets(TT.num_stops() + 1, 0);
+    for (uint32_t stop : TT.pattern_stops)
+        ++stop_pattern_offsets[stop + 1];
+    for (uint32_t s = 0; s < TT.num_stops(); ++s)
+        stop_pattern_offsets[s + 1] += stop_pattern_offsets[s];
+
+    vector<uint32_t> next(stop_pattern_offsets.begin(), stop_pattern_offsets.end() - 1);
+    vector<uint32_t> stop_patterns(TT.pattern_stops.size()), stop_pattern_positions(TT.pattern_stops.size());
+    for (uint32_t p = 0; p < TT.num_patterns(); ++p) {
+        const uint32_t *stops = TT.stops_of(p);
+        for (uint32_t i = 0; i < TT.pattern_size(p); ++i) {
+            uint32_t slot = next[stops[i]]++;
+            stop_patterns[slot] = p;
+            stop_pattern_positions[slot] = i;
+        }
+    }
+    TT.stop_pattern_offsets = move(stop_pattern_offsets);
+    TT.stop_patterns = move(stop_patterns);
+    TT.stop_pattern_positions = move(stop_pattern_positions);
+}
+
+// Footpaths between every two stops of stops.txt within MAX_WALK_DISTANCE, found
+// through a StopGrid (footpaths.h), and closed over walks of up to
+// closure_budget seconds if that is positive. Each stop's footpaths are ordered
+// by walk time, then by target stop.
+static void compile_transfers(const vector<StopHeaders> &stops, int32_t closure_budget) {
+    const uint32_t num_stops = TT.num_stops();
+    vector<const StopHeaders *> located(num_stops, nullptr);
+    for (auto &s : stops)
+        located[stop_index(s.stop_id)] = &s;
+    StopPoints points;
+    for (uint32_t stop = 0; stop < num_stops; ++stop) {
+        if (located[stop]) points.add(stop, located[stop]->stop_lat, located[stop]->stop_lon);
+    }
+
+    vector<Footpath> footpaths = find_footpaths(points, MAX_WALK_DISTANCE);
+    if (closure_budget > 0) {
+        footpaths = close_footpaths(footpaths, num_stops, closure_budget);
+        TT.transfer_closure = closure_budget;
+    }
+
+    vector<uint32_t> transfer_offsets(num_stops + 1, 0);
+    for (auto &f : footpaths) {
+        ++transfer_offsets[f.from + 1];
+        ++transfer_offsets[f.to + 1];
+    }
+    for (uint32_t s = 0; s < num_stops; ++s)
+        transfer_offsets[s + 1] += transfer_offsets[s];
+
+    vector<pair<int32_t,uint32_t>> transfers(transfer_offsets.back());
+    vector<uint32_t> next(transfer_offsets.begin(), transfer_offsets.end() - 1);
+    for (auto &f : footpaths) {
+        transfers[next[f.from]++] = { f.walk_time, f.to };
+        transfers[next[f.to]++] = { f.walk_time, f.from };
+    }
+    footpaths = vector<Footpath>();
+
+    vector<uint32_t> transfer_targets(transfers.size());
+    vector<int32_t> transfer_walk_times(transfers.size());
+    for (uint32_t s = 0; s < num_stops; ++s) {
+        sort(transfers.begin() + transfer_offsets[s], transfers.begin() + transfer_offsets[s + 1]);
+        for (uint32_t i = transfer_offsets[s]; i < transfer_offsets[s + 1]; ++i) {
+            transfer_walk_times[i] = transfers[i].first;
+            transfer_targets[i] = transfers[i].second;
+        }
+    }
+    TT.transfer_offsets = move(transfer_offsets);
+    TT.transfer_targets = move(transfer_targets);
+    TT.transfer_walk_times = move(transfer_walk_times);
+}
+
+void compile_timetable(const string &base_dir, int32_t closure_budget) {
+    TT = Timetable();
+
+    vector<StopHeaders> stops;
+    parse_stops(base_dir + "/stops.txt", stops);
+
+    FeedTrips trips;
+    read_trips(base_dir + "/trips.txt", trips);
+
+    TripRows rows;
+    read_stop_times(base_dir + "/stop_times.txt", trips, rows);
+
+    compile_stops(stops, rows);
+    compile_patterns(rows);
+    rows = TripRows();
+    compile_stop_patterns();
+    compile_transfers(stops, closure_budget);
+}
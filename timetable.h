@@ -0,0 +1,206 @@
+#ifndef TIMETABLE_H
+#define TIMETABLE_H
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+constexpr int32_t NO_TIME = std::numeric_limits<int32_t>::max();
+constexpr uint32_t NO_INDEX = std::numeric_limits<uint32_t>::max();
+
+class MappedFile;
+
+// Read-only array that either owns its elements (a freshly compiled timetable)
+// or views memory owned elsewhere (a mapped snapshot). Queries only read it.
+template <typename T>
+class FlatArray {
+public:
+    typedef T value_type;
+
+    FlatArray() = default;
+    FlatArray(const FlatArray &) = delete;
+    FlatArray &operator=(const FlatArray &) = delete;
+    FlatArray(FlatArray &&other) noexcept { *this = std::move(other); }
+
+    FlatArray &operator=(FlatArray &&other) noexcept {
+        // moving a vector keeps its buffer, so ptr stays valid
+        owned = std::move(other.owned);
+        ptr = other.ptr;
+        n = other.n;
+        other.ptr = nullptr;
+        other.n = 0;
+        return *this;
+    }
+    FlatArray &operator=(std::vector<T> &&elements) {
+        owned = std::move(elements);
+        ptr = owned.data();
+        n = owned.size();
+        return *this;
+    }
+
+    void view(const T *elements, size_t count) {
+        owned = std::vector<T>();
+        ptr = elements;
+        n = count;
+    }
+
+    const T &operator[](size_t i) const { return ptr[i]; }
+    const T *data() const { return ptr; }
+    size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+    const T *begin() const { return ptr; }
+    const T *end() const { return ptr + n; }
+
+private:
+    std::vector<T> owned;
+    const T *ptr = nullptr;
+    size_t n = 0;
+};
+
+// Strings packed back to back: string i is chars[offsets[i] .. offsets[i+1]).
+class StringTable {
+public:
+    StringTable &operator=(const std::vector<std::string> &strings);
+
+    std::string_view operator[](size_t i) const {
+        return std::string_view(chars.data() + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+    size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    // offsets start at 0, never decrease and end at chars.size()
+    bool closed() const {
+        if (offsets.empty()) return true;
+        for (size_t i = 0; i < size(); ++i)
+            if (offsets[i] > offsets[i + 1]) return false;
+        return offsets[0] == 0 && offsets[size()] == chars.size();
+    }
+
+    template <typename F>
+    void for_each_array(F &&f) {
+        f(offsets);
+        f(chars);
+    }
+
+private:
+    FlatArray<uint32_t> offsets;
+    FlatArray<char> chars;
+};
+
+// Query-time view of the feed. Stops, routes and trips are renumbered to
+// contiguous indices; GTFS ids are only kept in the side tables for printing.
+// Everything lives in flat arrays so that the timetable can be written out and
+// mapped back in as a snapshot (snapshot.h).
+struct Timetable {
+    // dense index -> GTFS id; stop_ids is sorted, which is how stop_index() finds stops
+    FlatArray<int32_t> stop_ids;
+    StringTable route_ids;
+    StringTable trip_ids;
+
+    // Trips grouped by their exact stop sequence within a GTFS route. Patterns
+    // are the routes RAPTOR scans; pattern_routes maps them back to route_ids.
+    FlatArray<uint32_t> pattern_routes;
+
+    // stops of pattern p: pattern_stops[pattern_stop_offsets[p] .. pattern_stop_offsets[p+1])
+    FlatArray<uint32_t> pattern_stop_offsets;
+    FlatArray<uint32_t> pattern_stops;
+
+    // trips of pattern p are the indices [pattern_trip_offsets[p], pattern_trip_offsets[p+1]).
+    // Patterns are FIFO: trips are ordered by departure at every stop, not just the first.
+    FlatArray<uint32_t> pattern_trip_offsets;
+    FlatArray<uint32_t> trip_patterns;
+
+    // Times of pattern p occupy a trips x stops block starting at pattern_time_offsets[p].
+    // Departures are stored stop-major, so the departures of all trips at one stop are
+    // adjacent for boarding searches; arrivals are stored trip-major, so one trip's
+    // arrivals along the pattern are adjacent for the route scan.
+    FlatArray<uint32_t> pattern_time_offsets;
+    FlatArray<uint32_t> trip_time_offsets; // start of trip t's row in arrivals
+    FlatArray<int32_t> arrivals;
+    FlatArray<int32_t> departures;
+
+    // visits of patterns to stop s: pattern stop_patterns[i] has s at position
+    // stop_pattern_positions[i], for i in [stop_pattern_offsets[s], stop_pattern_offsets[s+1]).
+    // A pattern visiting s twice, as loops do, is listed once per visit.
+    FlatArray<uint32_t> stop_pattern_offsets;
+    FlatArray<uint32_t> stop_patterns;
+    FlatArray<uint32_t> stop_pattern_positions;
+
+    // footpaths from stop s: (transfer_targets[i], transfer_walk_times[i])
+    // for i in [transfer_offsets[s], transfer_offsets[s+1]), shortest walk first,
+    // so that relaxing them can stop at the first walk that is too long
+    FlatArray<uint32_t> transfer_offsets;
+    FlatArray<uint32_t> transfer_targets;
+    FlatArray<int32_t> transfer_walk_times;
+
+    // Walking budget in seconds within which the footpaths are transitively
+    // closed, so that one footpath reaches whatever a chain of them within the
+    // budget does; 0 if they are only the footpaths within MAX_WALK_DISTANCE.
+    int32_t transfer_closure = 0;
+
+    // keeps the snapshot the arrays point into mapped, if there is one
+    std::shared_ptr<MappedFile> mapping;
+
+    // Calls f on every array, always in this order; snapshot files rely on it.
+    template <typename F>
+    void for_each_array(F &&f) {
+        f(stop_ids);
+        route_ids.for_each_array(f);
+        trip_ids.for_each_array(f);
+        f(pattern_routes);
+        f(pattern_stop_offsets);
+        f(pattern_stops);
+        f(pattern_trip_offsets);
+        f(trip_patterns);
+        f(pattern_time_offsets);
+        f(trip_time_offsets);
+        f(arrivals);
+        f(departures);
+        f(stop_pattern_offsets);
+        f(stop_patterns);
+        f(stop_pattern_positions);
+        f(transfer_offsets);
+        f(transfer_targets);
+        f(transfer_walk_times);
+    }
+
+    uint32_t num_stops() const { return stop_ids.size(); }
+    uint32_t num_routes() const { return route_ids.size(); }
+    uint32_t num_patterns() const { return pattern_routes.size(); }
+    uint32_t num_trips() const { return trip_ids.size(); }
+
+    uint32_t pattern_size(uint32_t p) const { return pattern_stop_offsets[p + 1] - pattern_stop_offsets[p]; }
+    uint32_t pattern_trip_count(uint32_t p) const { return pattern_trip_offsets[p + 1] - pattern_trip_offsets[p]; }
+    const uint32_t *stops_of(uint32_t p) const { return pattern_stops.data() + pattern_stop_offsets[p]; }
+
+    // departures of every trip of pattern p at stop position i, in trip order
+    const int32_t *stop_departures(uint32_t p, uint32_t i) const {
+        return departures.data() + pattern_time_offsets[p] + size_t(i) * pattern_trip_count(p);
+    }
+    // arrivals of trip t at every stop of its pattern
+    const int32_t *trip_arrivals(uint32_t t) const { return arrivals.data() + trip_time_offsets[t]; }
+
+    int32_t departure(uint32_t t, uint32_t i) const {
+        uint32_t p = trip_patterns[t];
+        return stop_departures(p, i)[t - pattern_trip_offsets[p]];
+    }
+    int32_t arrival(uint32_t t, uint32_t i) const { return trip_arrivals(t)[i]; }
+};
+
+extern Timetable TT;
+
+// Builds TT from the GTFS feed in base_dir without the tables and maps of gtfs.h:
+// stops.txt and trips.txt are read first, then stop_times.txt rows are folded
+// straight into per-trip runs, which become the patterns. A positive
+// closure_budget closes the footpaths over walks of up to that many seconds
+// (close_footpaths() in footpaths.h).
+void compile_timetable(const std::string &base_dir, int32_t closure_budget = 0);
+
+// Dense index of a GTFS stop_id, NO_INDEX if the stop is unknown.
+uint32_t stop_index(int gtfs_stop_id);
+
+// Dense index of a GTFS route_id, NO_INDEX if the route is unknown.
+uint32_t route_index(std::string_view gtfs_route_id);
+
+#endif
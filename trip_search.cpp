@@ -0,0 +1,142 @@
+#include "trip_search.h"
+
+#include <immintrin.h>
+
+using namespace std;
+
+// Branchless binary search until at most `window` candidates remain. Every
+// element before the returned base is < key and the answer lies in
+// [base, base + len], so counting the elements < key in base[0..len) finishes it.
+static inline const int32_t *narrow(const int32_t *base, uint32_t &len, int32_t key, uint32_t window) {
+    while (len > window) {
+        uint32_t half = len / 2;
+        base = base[half] < key ? base + half : base;
+        len -= half;
+    }
+    return base;
+}
+
+// Start of a full `window` of candidates around base, clamped to the array. The
+// elements it adds before base are < key and those after base + len are >= key,
+// so the count of elements < key in the window still locates the answer.
+static inline const int32_t *full_window(const int32_t *a, uint32_t n, const int32_t *base, uint32_t window) {
+    return base + window <= a + n ? base : a + n - window;
+}
+
+static uint32_t first_at_least_scalar(const int32_t *a, uint32_t n, int32_t key) {
+    uint32_t len = n;
+    const int32_t *base = narrow(a, len, key, 1);
+    return (base - a) + (len == 1 && *base < key);
+}
+
+// The vector kernels narrow the search to one window of a few vectors and then
+// count the departures below key in it without branching: the array is sorted,
+// so that count is the offset of the answer in the window. Columns shorter than
+// a window are counted directly.
+
+// SSE2 has no popcnt, so lanes below key are summed as -1s and reduced once.
+static inline uint32_t horizontal_count(__m128i negated_counts) {
+    __m128i sum = _mm_add_epi32(negated_counts, _mm_shuffle_epi32(negated_counts, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return -_mm_cvtsi128_si32(sum);
+}
+
+static uint32_t first_at_least_sse2(const int32_t *a, uint32_t n, int32_t key) {
+    const uint32_t window = 16;
+    const __m128i keys = _mm_set1_epi32(key);
+    __m128i counts = _mm_setzero_si128();
+
+    if (n < window) {
+        uint32_t i = 0, count = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            counts = _mm_add_epi32(counts, _mm_cmpgt_epi32(keys, block));
+        }
+        for (; i < n; ++i)
+            count += a[i] < key;
+        return count + horizontal_count(counts);
+    }
+
+    uint32_t len = n;
+    const int32_t *base = full_window(a, n, narrow(a, len, key, window), window);
+    for (uint32_t i = 0; i < window; i += 4) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(base + i));
+        counts = _mm_add_epi32(counts, _mm_cmpgt_epi32(keys, block));
+    }
+    return (base - a) + horizontal_count(counts);
+}
+
+__attribute__((target("avx2,popcnt")))
+static uint32_t first_at_least_avx2(const int32_t *a, uint32_t n, int32_t key) {
+    const uint32_t window = 32;
+    const __m256i keys = _mm256_set1_epi32(key);
+
+    if (n < window) {
+        uint32_t i = 0, count = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+            count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(keys, block))));
+        }
+        for (; i < n; ++i)
+            count += a[i] < key;
+        return count;
+    }
+
+    uint32_t len = n;
+    const int32_t *base = full_window(a, n, narrow(a, len, key, window), window);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < window; i += 8) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(base + i));
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(keys, block))));
+    }
+    return (base - a) + count;
+}
+
+__attribute__((target("avx512f,popcnt")))
+static uint32_t first_at_least_avx512(const int32_t *a, uint32_t n, int32_t key) {
+    const uint32_t window = 64;
+    const __m512i keys = _mm512_set1_epi32(key);
+
+    if (n < window) {
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < n; i += 16) {
+            __mmask16 lanes = n - i >= 16 ? 0xFFFF : (1u << (n - i)) - 1;
+            __m512i block = _mm512_maskz_loadu_epi32(lanes, a + i);
+            count += __builtin_popcount(_mm512_mask_cmplt_epi32_mask(lanes, block, keys));
+        }
+        return count;
+    }
+
+    uint32_t len = n;
+    const int32_t *base = full_window(a, n, narrow(a, len, key, window), window);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < window; i += 16) {
+        __m512i block = _mm512_loadu_si512(base + i);
+        count += __builtin_popcount(_mm512_cmplt_epi32_mask(block, keys));
+    }
+    return (base - a) + count;
+}
+
+const vector<SearchKernel> &search_kernels() {
+    static const vector<SearchKernel> kernels = [] {
+        __builtin_cpu_init();
+        return vector<SearchKernel>{
+            { "scalar", first_at_least_scalar, true },
+            { "sse2", first_at_least_sse2, bool(__builtin_cpu_supports("sse2")) },
+            { "avx2", first_at_least_avx2, bool(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) },
+            { "avx512", first_at_least_avx512, bool(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("popcnt")) },
+        };
+    }();
+    return kernels;
+}
+
+static const SearchKernel &best_kernel() {
+    const auto &kernels = search_kernels();
+    for (auto it = kernels.rbegin(); it != kernels.rend(); ++it) {
+        if (it->supported) return *it;
+    }
+    return kernels.front();
+}
+
+FirstAtLeastFn first_at_least = best_kernel().fn;
+const char *first_at_least_name = best_kernel().name;
@@ -0,0 +1,23 @@
+#ifndef TRIP_SEARCH_H
+#define TRIP_SEARCH_H
+
+#include <cstdint>
+#include <vector>
+
+// Index of the first element >= key in the sorted array a[0..n), n if there is none.
+typedef uint32_t (*FirstAtLeastFn)(const int32_t *a, uint32_t n, int32_t key);
+
+struct SearchKernel {
+    const char *name;
+    FirstAtLeastFn fn;
+    bool supported; // the CPU running us has the instructions this kernel needs
+};
+
+// Every compiled kernel (scalar, sse2, avx2, avx512), fastest last.
+const std::vector<SearchKernel> &search_kernels();
+
+// Fastest supported kernel, chosen through CPUID when the program starts.
+extern FirstAtLeastFn first_at_least;
+extern const char *first_at_least_name;
+
+#endif